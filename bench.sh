@@ -0,0 +1,51 @@
+#! /bin/sh
+
+# builds the interpreter at each optimization level and runs the workloads
+# of bench/suite after the prelude, and the prelude alone.
+# prints one tab separated line per level and workload, after a header:
+# the fastest wall time of the runs in milliseconds, and the totals of the
+# memory manager printed by `--stats` for that run.
+#   ./bench.sh > before.tsv
+# OPTS sets the levels, REPS the runs per workload, ARGS is passed to lisp.bin:
+#   OPTS=-O3 REPS=5 ARGS=--vm ./bench.sh
+
+OPTS=${OPTS:-"-O2 -O3"}
+REPS=${REPS:-3}
+ARGS=${ARGS:-}
+
+printf 'opt\tworkload\twall_ms\tallocated\tminor_gcs\tfull_gcs\tgc_us\tpeak_heap_bytes\n'
+
+for opt in $OPTS; do
+    bin=bench$opt.bin
+    gcc $opt *.c \
+        -o $bin \
+        -std=c17 -pedantic -Wall -Wshadow -Wpointer-arith -Wcast-qual -pthread \
+            -Wstrict-prototypes || exit 1
+
+    for workload in prelude bench/suite/*.lisp; do
+        name=$(basename $workload .lisp)
+        files=lisp
+        if [ $workload != prelude ]; then
+            files="lisp $workload"
+        fi
+
+        best=
+        for rep in $(seq $REPS); do
+            begin=$(date +%s%N)
+            ./$bin $ARGS --stats $files > /dev/null 2> bench.stats || {
+                echo "$name failed at $opt" >&2
+                exit 1
+            }
+            ms=$((($(date +%s%N) - begin) / 1000000))
+            if [ -z "$best" ] || [ $ms -lt $best ]; then
+                best=$ms
+                stats=$(tail -n 1 bench.stats)
+            fi
+        done
+
+        # allocated=1 minor_gcs=2 ... becomes 1	2	...
+        printf '%s\t%s\t%s\t%s\n' $opt $name $best \
+            "$(echo $stats | sed 's/[a-z_]*=//g; s/ /\t/g')"
+    done
+    rm -f $bin bench.stats
+done
@@ -0,0 +1,33 @@
+; bignum arithmetic:
+; 1000! is computed repeatedly, its products overflow an i64 early on.
+; the sum of small ints at the end stays on the i64 fast path.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/bignum.lisp
+
+(def fact (.\ (n acc)
+    (cond
+        ((= n 0) acc)
+        (1 (fact (- n 1) (* acc n)))
+    )
+))
+
+(def repeat (.\ (r f)
+    (cond
+        ((= r 0) nil)
+        (1 (progn (f) (repeat (- r 1) f)))
+    )
+))
+
+(repeat 20 (.\ () (fact 1000 1)))
+
+(% (fact 1000 1) 1000000007)
+
+(def count (.\ (n acc)
+    (cond
+        ((= n 0) acc)
+        (1 (count (- n 1) (+ acc n)))
+    )
+))
+
+(count 1000000 0)
@@ -0,0 +1,24 @@
+; small helpers and constant formulas in a hot loop:
+; when `loop` is defined, `(* 60 60 24)` and `(hd '(7 8))` are folded,
+; `inc`, `twice` and `scale` are inlined and the dead `cond` clause is dropped,
+; so every iteration makes one call instead of four.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/fold.lisp
+
+(def debug nil)
+
+(def inc (.\ (x) (+ 1 x)))
+(def twice (.\ (x) (* 2 x)))
+(def scale (.\ (x) (+ (* x (* 60 60 24)) (hd '(7 8)))))
+
+(def loop (.\ (n acc)
+    (cond
+        ((= n 0) acc)
+        (debug (loop 0 'never))
+        (1 (loop (- n 1) (+ acc (twice (inc (scale n))))))
+    )
+))
+
+loop
+(loop 1000000 0)
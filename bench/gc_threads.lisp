@@ -0,0 +1,29 @@
+; parallel full collections:
+; a tree of about 4 million nodes is kept alive while the garbage is
+; collected with 1, 2, 4 and 8 GC threads, three times each.
+; each run prints the threads and the pauses in microseconds,
+; which shrink with the threads while there are cores for them.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/gc_threads.lisp
+
+(def tree (.\ (depth)
+    (cond
+        ((= depth 0) (cons depth nil))
+        (1 (list depth (tree (- depth 1)) (tree (- depth 1))))
+    )
+))
+
+(def live (tree 20))
+
+(def pauses (.\ (threads)
+    (progn
+        (gc-threads threads)
+        (list threads (gc) (gc) (gc))
+    )
+))
+
+(pauses 1)
+(pauses 2)
+(pauses 4)
+(pauses 8)
@@ -0,0 +1,31 @@
+; hash map lookups:
+; 200000 keys, lists of two ints, are counted into a map of 5000 entries,
+; then every entry is looked up again.
+; with an association list every step would scan up to 5000 entries.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/hash.lisp
+
+(def counts (make-hash))
+
+(def count (.\ (k)
+    (cond
+        ((= k 200000) nil)
+        (1 (progn
+            (hash-put! counts (list (% k 100) (% k 50)) (+ 1 (hash-get counts (list (% k 100) (% k 50)) 0)))
+            (hash-put! counts (% k 4900) (+ 1 (hash-get counts (% k 4900) 0)))
+            (count (+ k 1))
+        ))
+    )
+))
+
+(def sum (.\ (keys acc)
+    (cond
+        ((nil? keys) acc)
+        (1 (sum (tl keys) (+ acc (hash-get counts (hd keys)))))
+    )
+))
+
+(count 0)
+(hash-count counts)
+(sum (hash-keys counts) 0)
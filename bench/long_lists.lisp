@@ -0,0 +1,29 @@
+; garbage collection with long lists alive:
+; every collection has to mark lists of hundreds of thousands of nodes,
+; while a tail-recursive loop keeps allocating garbage.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/long_lists.lisp
+
+(def build (.\ (n acc)
+    (cond
+        ((= n 0) acc)
+        (1 (build (- n 1) (cons n acc)))
+    )
+))
+
+(def count (.\ (xs acc)
+    (cond
+        ((nil? xs) acc)
+        (1 (count (tl xs) (+ acc 1)))
+    )
+))
+
+(def xs (build 300000 nil))
+(def ys (build 300000 nil))
+(def zs (build 300000 nil))
+
+(count xs 0)
+(count ys 0)
+(count zs 0)
+(count (build 300000 nil) 0)
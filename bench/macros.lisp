@@ -0,0 +1,26 @@
+; macro calls in a hot loop:
+; `if`, `and` and `when` are macros, every iteration runs three macro calls.
+; the tree walker expands each call site once and reuses the expansion.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/macros.lisp
+
+(def if (m\ (condition then else)
+    `(cond (#condition #then) (1 #else))
+))
+
+(def and (m\ (a b)
+    `(cond (#a #b) (1 nil))
+))
+
+(def when (m\ (condition then)
+    `(cond (#condition #then) (1 nil))
+))
+
+(def loop (.\ (n acc)
+    (if (= n 0)
+        acc
+        (loop (- n 1) (if (and (< 0 n) (= (% n 3) 0)) (+ acc 1) (+ acc (when 1 2)))))
+))
+
+(loop 300000 0)
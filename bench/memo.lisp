@@ -0,0 +1,36 @@
+; memoization:
+; the naive doubly recursive fibonacci is memoized with `memo`,
+; so fib 90 takes 91 misses, where the plain version would take 10^18 calls.
+; the plain version is only run up to 22 for comparison.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/memo.lisp
+
+(def fib (.\ (n)
+    (cond
+        ((< n 2) n)
+        (1 (+ (fib (- n 1)) (fib (- n 2))))
+    )
+))
+
+(def mfib (memo (.\ (n)
+    (cond
+        ((< n 2) n)
+        (1 (+ (mfib (- n 1)) (mfib (- n 2))))
+    )
+)))
+
+(fib 22)
+(mfib 90)
+(memo-stats mfib)
+
+; a cache of 10 entries evicts the oldest ones, which are not needed again
+(def small (memo (.\ (n)
+    (cond
+        ((< n 2) n)
+        (1 (+ (small (- n 1)) (small (- n 2))))
+    )
+) 10))
+
+(small 90)
+(memo-stats small)
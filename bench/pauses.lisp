@@ -0,0 +1,46 @@
+; pause times:
+; a tree of about 3 million nodes stays alive while short lived lists are
+; allocated, once with full collections in one pause (budget 0) and once
+; incrementally with a budget of 1000 microseconds.
+; each run prints the number of pauses, the longest one, the 99th percentile
+; and the sum of them in microseconds.
+; with the budget the nursery shrinks until a minor collection fits into it, so
+; the 99th percentile is close to the budget, while there are more pauses and
+; their sum is larger. the longest pause also counts the time the thread was
+; not scheduled, so on a busy machine it can be well over the budget.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/pauses.lisp
+
+(def tree (.\ (depth)
+    (cond
+        ((= depth 0) (cons depth nil))
+        (1 (list depth (tree (- depth 1)) (tree (- depth 1))))
+    )
+))
+
+(def range (.\ (a b acc)
+    (cond
+        ((< b a) acc)
+        (1 (range a (- b 1) (cons b acc)))
+    )
+))
+
+; every round a list of 1000 elements becomes garbage,
+; and a new subtree replaces one that was kept
+(def churn (.\ (n kept)
+    (cond
+        ((= n 0) (hd kept))
+        (1 (churn (- n 1) (cons (hd (range 1 1000 nil)) (cond ((= 0 (% n 50)) (list (tree 12))) (1 kept)))))
+    )
+))
+
+(def live (tree 19))
+
+(gc-pauses)
+(gc-pause-budget 0)
+(churn 20000 nil)
+(gc-pauses)
+(gc-pause-budget 1000)
+(churn 20000 nil)
+(gc-pauses)
@@ -0,0 +1,93 @@
+; parallel map:
+; the primes below 20000 are found by trial division with `pfilter`,
+; and the numbers are summed by their divisors with `pmap`,
+; with 1, 2, 4 and 8 threads. each run prints the threads, the result and
+; the milliseconds it took, which shrink with the threads while there are
+; cores for them.
+; then the threads share a memoized function, whose cache they fill at the
+; same time. each run also prints the hits, misses and entries of the cache,
+; the hits and misses add up to the 1000 calls and there are 100 entries,
+; threads that miss the same number at once both count a miss.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/pmap.lisp
+
+(def range (.\ (a b acc)
+    (cond
+        ((< b a) acc)
+        (1 (range a (- b 1) (cons b acc)))
+    )
+))
+
+(def prime-from? (.\ (n d)
+    (cond
+        ((< n (* d d)) 1)
+        ((= 0 (% n d)) nil)
+        (1 (prime-from? n (+ d 1)))
+    )
+))
+
+(def prime? (.\ (n) (prime-from? n 2)))
+
+(def divisor-sum (.\ (n d acc)
+    (cond
+        ((< n d) acc)
+        ((= 0 (% n d)) (divisor-sum n (+ d 1) (+ acc d)))
+        (1 (divisor-sum n (+ d 1) acc))
+    )
+))
+
+(def len (.\ (l acc)
+    (cond
+        ((nil? l) acc)
+        (1 (len (tl l) (+ acc 1)))
+    )
+))
+
+(def sum (.\ (l acc)
+    (cond
+        ((nil? l) acc)
+        (1 (sum (tl l) (+ acc (hd l))))
+    )
+))
+
+(def numbers (range 2 20000 nil))
+(def small (range 1 1000 nil))
+
+; the arguments are evaluated in order, so `start` is taken before the run
+(def timed (.\ (threads start result)
+    (list threads result (- (clock) start))
+))
+
+(def time-primes (.\ (threads)
+    (timed threads (clock) (len (pfilter prime? numbers threads) 0))
+))
+
+(def time-divisors (.\ (threads)
+    (timed threads (clock) (sum (pmap (.\ (n) (divisor-sum n 1 0)) small threads) 0))
+))
+
+; a new cache for each run, `f` is called with 100 different numbers
+(def time-memo (.\ (threads)
+    ((.\ (f)
+        (list
+            (timed threads (clock) (sum (pmap (.\ (n) (f (% n 100))) small threads) 0))
+            (memo-stats f)
+        ))
+     (memo (.\ (n) (divisor-sum n 1 0))))
+))
+
+(time-primes 1)
+(time-primes 2)
+(time-primes 4)
+(time-primes 8)
+
+(time-divisors 1)
+(time-divisors 2)
+(time-divisors 4)
+(time-divisors 8)
+
+(time-memo 1)
+(time-memo 2)
+(time-memo 4)
+(time-memo 8)
@@ -0,0 +1,19 @@
+; streaming the input file:
+; every line of input.txt is read with `read-line` and the numbers are summed.
+; only the current line is a value, so memory does not grow with the file.
+;
+; this file does not need the prelude, but an input.txt of numbers:
+;   seq 1 2000000 > input.txt
+;   ./lisp.bin bench/read_lines.lisp
+
+(def sum (.\ (acc) (add-line acc (read-line))))
+
+(def add-line (.\ (acc line)
+    (cond
+        ((nil? line) acc)
+        ((nil? (str-int line)) (sum acc))
+        (1 (sum (+ acc (str-int line))))
+    )
+))
+
+(sum 0)
@@ -0,0 +1,5 @@
+; startup latency: initializing the interpreter and evaluating one form.
+; the heap is not touched beyond what the builtins and input.txt need.
+;   ./lisp.bin bench/startup.lisp
+
+(+ 1 2)
@@ -0,0 +1,35 @@
+; string processing:
+; a text of 20000 numbered lines is built once,
+; then it is split into lines which are parsed and summed over and over.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/strings.lisp
+
+; the bytes of "1234\n" repeated n times, in front of acc
+(def build (.\ (n acc)
+    (cond
+        ((= n 0) acc)
+        (1 (build (- n 1) (cons 49 (cons 50 (cons 51 (cons 52 (cons 10 acc)))))))
+    )
+))
+
+(def text (list->str (build 20000 nil)))
+
+(def sum (.\ (lines acc)
+    (cond
+        ((nil? lines) acc)
+        ((nil? (str-int (hd lines))) (sum (tl lines) acc))
+        (1 (sum (tl lines) (+ acc (str-int (hd lines)))))
+    )
+))
+
+(def repeat (.\ (n f)
+    (cond
+        ((= n 0) nil)
+        (1 (progn (f) (repeat (- n 1) f)))
+    )
+))
+
+(repeat 20 (.\ () (sum (str-split text "\n") 0)))
+
+(sum (str-split text "\n") 0)
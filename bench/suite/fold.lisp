@@ -0,0 +1,22 @@
+; `foldl` over `nums`, the 20000 numbers of the prelude, with builtins,
+; lambdas and partially applied functions as the step.
+;
+; run after the prelude, see bench.sh:
+;   ./lisp.bin lisp bench/suite/fold.lisp
+
+(defun fold.loop(n acc)
+    (cond
+        ((= n 0) acc)
+        (else (fold.loop (- n 1)
+            (+ acc
+                (sum nums)
+                (len nums)
+                (max nums)
+                (foldl 0 (.\ (x y) (+ x (* y y))) nums)
+                (len (rev nums))
+            )
+        ))
+    )
+)
+
+(fold.loop 2 0)
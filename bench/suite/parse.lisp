@@ -0,0 +1,41 @@
+; parsing input.txt with the list functions of the prelude:
+; the lines are read once, then split into words and their numbers are
+; converted with `string->int`, which works on lists of bytes.
+;
+; run after the prelude, see bench.sh:
+;   ./lisp.bin lisp bench/suite/parse.lisp
+
+(defun read-lines(acc)
+    (let line (read-line)
+    (cond
+        ((nil? line) (rev acc))
+        (else (read-lines (cons (str->list line) acc)))
+    ))
+)
+
+(def lines (read-lines nil))
+
+(def digit? (.\ (c) (and (<= (str-ref "0" 0) c) (<= c (str-ref "9" 0)))))
+
+; sum of the numbers in a line, words without digits count as 0
+(defun line.sum(line)
+    (sum (map
+        (.\ (word)
+            (let digits (filter digit? word)
+            (cond
+                ((nil? digits) 0)
+                (else (string->int digits))
+            ))
+        )
+        (split (str-ref " " 0) line)
+    ))
+)
+
+(defun parse.loop(n acc)
+    (cond
+        ((= n 0) acc)
+        (else (parse.loop (- n 1) (+ acc (sum (map line.sum lines)))))
+    )
+)
+
+(parse.loop 20 0)
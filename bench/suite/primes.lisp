@@ -0,0 +1,7 @@
+; `prime?` over `range`: every candidate tests all smaller divisors,
+; through `map` and `foldr`, so the lists of divisors are built and dropped.
+;
+; run after the prelude, see bench.sh:
+;   ./lisp.bin lisp bench/suite/primes.lisp
+
+(len (filter prime? (range 1 450)))
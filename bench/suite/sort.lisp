@@ -0,0 +1,28 @@
+; insertion `sort` of lists of pseudo random numbers.
+; every insertion conses a new prefix, so most of the work is allocating
+; short-lived nodes.
+;
+; run after the prelude, see bench.sh:
+;   ./lisp.bin lisp bench/suite/sort.lisp
+
+; linear congruential generator, the numbers stay below 2^31
+(defun rand.next(x) (% (+ (* x 1103515245) 12345) 2147483648))
+
+(defun rand.list(n x acc)
+    (cond
+        ((= n 0) acc)
+        (else (rand.list (- n 1) (rand.next x) (cons (% x 1000000) acc)))
+    )
+)
+
+(defun sorted?(xs)
+    (cond
+        ((nil? (tl xs)) true)
+        ((< (el 1 xs) (hd xs)) nil)
+        (else (sorted? (tl xs)))
+    )
+)
+
+(assert (sorted? (sort (rand.list 300 1 nil))))
+(assert (sorted? (sort (rand.list 300 2 nil))))
+(assert (sorted? (sort (rand.list 300 3 nil))))
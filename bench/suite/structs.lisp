@@ -0,0 +1,43 @@
+; the struct macros of the prelude: `defstruct` instances are built,
+; read and updated through their typed constructor and accessors,
+; and `sn` structs are updated with `su` and read with `sg`.
+;
+; run after the prelude, see bench.sh:
+;   ./lisp.bin lisp bench/suite/structs.lisp
+
+(defstruct Particle(
+    (int? x)
+    (int? y)
+    (int? dx)
+    (int? dy)
+))
+
+(defun particle.step(p)
+    (Particle
+        (+ (Particle.x p) (Particle.dx p))
+        (+ (Particle.y p) (Particle.dy p))
+        (Particle.dx p)
+        (- (Particle.dy p) 1)
+    )
+)
+
+(defun particle.run(n p)
+    (cond
+        ((= n 0) p)
+        (else (particle.run (- n 1) (Particle.x! (particle.step p) 0)))
+    )
+)
+
+(defun config.sum(n acc)
+    (cond
+        ((= n 0) acc)
+        (else (config.sum (- n 1)
+            (let config (su (sn ((width 10) (height 20) (depth 30))) width n)
+                (+ acc (sg config width) (sg config depth))
+            )
+        ))
+    )
+)
+
+(Particle.y (particle.run 20000 (Particle 0 0 1 100)))
+(config.sum 5000 0)
@@ -0,0 +1,36 @@
+; symbol interning with a full symbol table:
+; 729 names are generated with `symcat` and defined,
+; then they are interned again by name over and over.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/symbols.lisp
+
+(def letters '(p q r s t u v w x))
+
+(def each (.\ (xs f)
+    (cond
+        ((nil? xs) nil)
+        (1 (progn (f (hd xs)) (each (tl xs) f)))
+    )
+))
+
+(def each-name (.\ (f)
+    (each letters (.\ (x)
+        (each letters (.\ (y)
+            (each letters (.\ (z)
+                (f (symcat x y z))
+            ))
+        ))
+    ))
+))
+
+(def repeat (.\ (n f)
+    (cond
+        ((= n 0) nil)
+        (1 (progn (f) (repeat (- n 1) f)))
+    )
+))
+
+(each-name (.\ (name) (eval (list 'def name 1))))
+
+(repeat 30 (.\ () (each-name (.\ (name) (eval name)))))
@@ -0,0 +1,29 @@
+; tail calls run in constant C stack space:
+; a million iterations of a tail-recursive loop through a lambda body,
+; `cond` branches, `progn` and a macro expansion.
+;
+; this file does not need the prelude, run it with a small stack
+; to check that the stack does not grow:
+;   (ulimit -s 64; ./lisp.bin bench/tail_loop.lisp)
+
+(def when-even (m\ (n then else)
+    `(cond
+        ((= 0 (% #n 2)) #then)
+        (1 #else)
+    )
+))
+
+(def count-down (.\ (n acc)
+    (cond
+        ((= n 0) acc)
+        (1 (progn
+            n
+            (when-even n
+                (count-down (- n 1) (+ acc 2))
+                (count-down (- n 1) acc)
+            )
+        ))
+    )
+))
+
+(count-down 1000000 0)
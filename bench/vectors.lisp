@@ -0,0 +1,35 @@
+; indexed access:
+; a vector of 100000 elements is filled with fresh lists, which have to
+; survive collections through the write barrier, then it is summed by index.
+; the same sum over a list with `el` would be quadratic.
+;
+; this file does not need the prelude:
+;   ./lisp.bin bench/vectors.lisp
+
+(def n 100000)
+(def v (make-vector n nil))
+
+(def fill (.\ (k)
+    (cond
+        ((= k n) nil)
+        (1 (progn (vector-set! v k (list k (+ k 1))) (fill (+ k 1))))
+    )
+))
+
+(def sum (.\ (k acc)
+    (cond
+        ((= k n) acc)
+        (1 (sum (+ k 1) (+ acc (el 1 (vector-ref v k)))))
+    )
+))
+
+(def repeat (.\ (r f)
+    (cond
+        ((= r 0) nil)
+        (1 (progn (f) (repeat (- r 1) f)))
+    )
+))
+
+(repeat 3 (.\ () (progn (fill 0) (sum 0 0))))
+
+(sum 0 0)
@@ -0,0 +1,10 @@
+; the prelude functions `sort`, `prime?`, `map` and `filter`,
+; run by the tree walker and by the bytecode VM:
+;   ./lisp.bin lisp bench/vm.lisp
+;   ./lisp.bin --vm lisp bench/vm.lisp
+
+(def xs (map (.\ (x) (% (* x 7919) 1000)) (range 0 1000)))
+(len (sort xs))
+(len (filter prime? (range 1 600)))
+(len (map inc (range 0 20000)))
+(len (filter (.\ (x) (= 0 (% x 3))) (range 0 20000)))
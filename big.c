@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lisp.h"
+#include "assert.h"
+
+/*
+arbitrary precision integers, for the results of arithmetic that do not fit into an i64.
+a bignum is a sign and a magnitude of 32 bit limbs, least significant first.
+values that fit into an i64 are always plain ints, so the arithmetic builtins
+only end up here after an overflow or if an argument is a bignum already.
+the magnitude lives in the large object space.
+*/
+
+struct big
+{
+    int negative;
+    // limbs in use, and limbs allocated
+    i64 len;
+    i64 cap;
+    uint32_t limbs[];
+};
+
+/* view of the magnitude of an int or a bignum */
+typedef struct
+{
+    int negative;
+    i64 len;
+    uint32_t *limbs;
+    // limbs of a plain int
+    uint32_t small[2];
+} num_t;
+
+static size_t big_size(i64 len)
+{
+    return sizeof(big_t) + (size_t)len * sizeof(uint32_t);
+}
+
+/* the limbs of an int are stored in `n`, which has to stay in scope while they are used */
+static void load(ptr i, num_t *n)
+{
+    if (kind(i) == T_BIG)
+    {
+        big_t *b = get_big(i);
+        n->negative = b->negative;
+        n->len = b->len;
+        n->limbs = b->limbs;
+        return;
+    }
+    i64 value = get_int(i);
+    n->negative = value < 0;
+    // negating as unsigned also works for the smallest i64
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    n->small[0] = (uint32_t)magnitude;
+    n->small[1] = (uint32_t)(magnitude >> 32);
+    n->len = n->small[1] ? 2 : n->small[0] ? 1 : 0;
+    n->limbs = n->small;
+}
+
+/* allocates a bignum with room for `len` limbs, which are zero */
+static big_t *alloc_big(i64 len)
+{
+    big_t *b = alloc_large(big_size(len));
+    b->negative = false;
+    b->len = len;
+    b->cap = len;
+    memset(b->limbs, 0, (size_t)len * sizeof(uint32_t));
+    return b;
+}
+
+void big_destroy(big_t *b)
+{
+    free_large(b, big_size(b->cap));
+}
+
+/* turns a result into a lisp value, which is a plain int if it fits */
+static ptr finish(big_t *b)
+{
+    while (b->len && !b->limbs[b->len - 1])
+    {
+        b->len--;
+    }
+    if (b->len <= 2)
+    {
+        uint64_t magnitude = b->len ? b->limbs[0] : 0;
+        if (b->len == 2)
+        {
+            magnitude |= (uint64_t)b->limbs[1] << 32;
+        }
+        if (magnitude <= (uint64_t)INT64_MAX || (b->negative && magnitude == (uint64_t)INT64_MAX + 1))
+        {
+            int negative = b->negative;
+            big_destroy(b);
+            return new_int(negative ? (i64)-magnitude : (i64)magnitude);
+        }
+    }
+    if (!b->len)
+    {
+        b->negative = false;
+    }
+    return new_big(b);
+}
+
+static int mag_cmp(num_t *a, num_t *b)
+{
+    if (a->len != b->len)
+    {
+        return a->len < b->len ? -1 : 1;
+    }
+    for (i64 k = a->len - 1; k >= 0; k--)
+    {
+        if (a->limbs[k] != b->limbs[k])
+        {
+            return a->limbs[k] < b->limbs[k] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* out = a + b, out has room for max(a, b) + 1 limbs */
+static void mag_add(num_t *a, num_t *b, uint32_t *out)
+{
+    uint64_t carry = 0;
+    i64 len = a->len > b->len ? a->len : b->len;
+    for (i64 k = 0; k < len; k++)
+    {
+        carry += k < a->len ? a->limbs[k] : 0;
+        carry += k < b->len ? b->limbs[k] : 0;
+        out[k] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    out[len] = (uint32_t)carry;
+}
+
+/* out = a - b, where a >= b */
+static void mag_sub(num_t *a, num_t *b, uint32_t *out)
+{
+    int64_t borrow = 0;
+    for (i64 k = 0; k < a->len; k++)
+    {
+        int64_t diff = (int64_t)a->limbs[k] - (k < b->len ? b->limbs[k] : 0) - borrow;
+        borrow = diff < 0;
+        out[k] = (uint32_t)(diff + (borrow << 32));
+    }
+}
+
+/* sum of a and b, where b is negated if `subtract` is set */
+static ptr add(ptr x, ptr y, int subtract)
+{
+    num_t a, b;
+    load(x, &a);
+    load(y, &b);
+    b.negative ^= subtract;
+    i64 len = (a.len > b.len ? a.len : b.len) + 1;
+    big_t *r = alloc_big(len);
+    if (a.negative == b.negative)
+    {
+        mag_add(&a, &b, r->limbs);
+        r->negative = a.negative;
+    }
+    else if (mag_cmp(&a, &b) >= 0)
+    {
+        mag_sub(&a, &b, r->limbs);
+        r->negative = a.negative;
+    }
+    else
+    {
+        mag_sub(&b, &a, r->limbs);
+        r->negative = b.negative;
+    }
+    return finish(r);
+}
+
+ptr big_add(ptr a, ptr b)
+{
+    return add(a, b, false);
+}
+
+ptr big_sub(ptr a, ptr b)
+{
+    return add(a, b, true);
+}
+
+ptr big_mul(ptr x, ptr y)
+{
+    num_t a, b;
+    load(x, &a);
+    load(y, &b);
+    big_t *r = alloc_big(a.len + b.len);
+    for (i64 i = 0; i < a.len; i++)
+    {
+        uint64_t carry = 0;
+        for (i64 j = 0; j < b.len; j++)
+        {
+            carry += (uint64_t)a.limbs[i] * b.limbs[j] + r->limbs[i + j];
+            r->limbs[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r->limbs[i + b.len] = (uint32_t)carry;
+    }
+    r->negative = a.negative != b.negative;
+    return finish(r);
+}
+
+/*
+quotient and remainder of a division that truncates towards zero,
+the remainder has the sign of the dividend, like in C.
+the magnitudes are divided bit by bit, which is plenty fast for the sizes
+that come up, as division by a bignum is rare.
+*/
+static ptr divide(ptr x, ptr y, int remainder)
+{
+    num_t a, b;
+    load(x, &a);
+    load(y, &b);
+    assert(b.len && "division by zero");
+
+    big_t *q = alloc_big(a.len);
+    big_t *r = alloc_big(b.len + 1);
+    num_t rem = {false, 0, r->limbs, {0, 0}};
+
+    for (i64 bit = a.len * 32 - 1; bit >= 0; bit--)
+    {
+        // rem = rem << 1 | next bit of a
+        uint32_t carry = (a.limbs[bit / 32] >> (bit % 32)) & 1;
+        for (i64 k = 0; k < b.len + 1; k++)
+        {
+            uint32_t next = r->limbs[k] >> 31;
+            r->limbs[k] = r->limbs[k] << 1 | carry;
+            carry = next;
+        }
+        rem.len = b.len + 1;
+        while (rem.len && !r->limbs[rem.len - 1])
+        {
+            rem.len--;
+        }
+        if (mag_cmp(&rem, &b) >= 0)
+        {
+            mag_sub(&rem, &b, r->limbs);
+            q->limbs[bit / 32] |= (uint32_t)1 << (bit % 32);
+        }
+    }
+
+    q->negative = a.negative != b.negative;
+    r->negative = a.negative;
+    if (remainder)
+    {
+        big_destroy(q);
+        return finish(r);
+    }
+    big_destroy(r);
+    return finish(q);
+}
+
+ptr big_div(ptr a, ptr b)
+{
+    return divide(a, b, false);
+}
+
+ptr big_mod(ptr a, ptr b)
+{
+    return divide(a, b, true);
+}
+
+int big_cmp(ptr x, ptr y)
+{
+    num_t a, b;
+    load(x, &a);
+    load(y, &b);
+    if (a.negative != b.negative)
+    {
+        return a.negative ? -1 : 1;
+    }
+    int cmp = mag_cmp(&a, &b);
+    return a.negative ? -cmp : cmp;
+}
+
+uint64_t big_hash(ptr i)
+{
+    big_t *b = get_big(i);
+    uint64_t hash = 14695981039346656037u ^ (uint64_t)b->negative;
+    for (i64 k = 0; k < b->len; k++)
+    {
+        hash ^= b->limbs[k];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+/* parses a string of decimal digits */
+ptr big_parse(char *digits, i64 len)
+{
+    // every digit adds less than 4 bits
+    big_t *r = alloc_big(len / 8 + 1);
+    for (i64 d = 0; d < len; d++)
+    {
+        uint64_t carry = (uint64_t)(digits[d] - '0');
+        for (i64 k = 0; k < r->len; k++)
+        {
+            carry += (uint64_t)r->limbs[k] * 10;
+            r->limbs[k] = (uint32_t)carry;
+            carry >>= 32;
+        }
+    }
+    return finish(r);
+}
+
+/* prints a bignum in decimal, by dividing a copy by 10^9 repeatedly */
+void big_print(ptr i)
+{
+    big_t *b = get_big(i);
+    uint32_t *limbs = malloc((size_t)b->len * sizeof(uint32_t));
+    // every 9 digits take 30 bits or more
+    uint32_t *chunks = malloc((size_t)(b->len * 32 / 29 + 1) * sizeof(uint32_t));
+    assert(limbs && chunks);
+    memcpy(limbs, b->limbs, (size_t)b->len * sizeof(uint32_t));
+
+    i64 len = b->len;
+    i64 chunks_len = 0;
+    // bignums are never 0, there is at least one chunk
+    assert(len > 0);
+    do
+    {
+        uint64_t rem = 0;
+        for (i64 k = len - 1; k >= 0; k--)
+        {
+            rem = rem << 32 | limbs[k];
+            limbs[k] = (uint32_t)(rem / 1000000000);
+            rem %= 1000000000;
+        }
+        chunks[chunks_len++] = (uint32_t)rem;
+        while (len && !limbs[len - 1])
+        {
+            len--;
+        }
+    } while (len);
+
+    printf("%s%u", b->negative ? "-" : "", chunks[chunks_len - 1]);
+    for (i64 k = chunks_len - 2; k >= 0; k--)
+    {
+        printf("%09u", chunks[k]);
+    }
+    free(limbs);
+    free(chunks);
+}
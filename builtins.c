@@ -1,15 +1,17 @@
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "lisp.h"
 #include "assert.h"
 
-static int c_eq(ptr a, ptr b)
+int c_eq(ptr a, ptr b)
 {
     if (a == b)
     {
         return 1;
     }
-    if (a < 0 || b < 0 || kind(a) != kind(b))
+    if (kind(a) != kind(b))
     {
         return 0;
     }
@@ -21,9 +23,36 @@ static int c_eq(ptr a, ptr b)
         return get_symbol(a) == get_symbol(b);
     case T_INT:
         return get_int(a) == get_int(b);
+    case T_BIG:
+        return big_cmp(a, b) == 0;
     case T_CON:
         return c_eq(get_head(a), get_head(b)) &&
                c_eq(get_tail(a), get_tail(b));
+    case T_ENV:
+        return c_eq(get_frame(a), get_frame(b)) &&
+               c_eq(get_parent(a), get_parent(b));
+    case T_STR:
+        return get_string_len(a) == get_string_len(b) &&
+               !memcmp(get_string(a), get_string(b), (size_t)get_string_len(a));
+    case T_VEC:
+        if (get_vector_len(a) != get_vector_len(b))
+        {
+            return 0;
+        }
+        for (i64 k = 0; k < get_vector_len(a); k++)
+        {
+            if (!c_eq(get_vector_item(a, k), get_vector_item(b, k)))
+            {
+                return 0;
+            }
+        }
+        return 1;
+    case T_FUN:
+    case T_MAC:
+    case T_SPC:
+    case T_MAP:
+        // only equal to themselves
+        return 0;
     default:
         failwith("unreachable");
     }
@@ -36,72 +65,129 @@ static ptr eq(ptr i)
     return c_eq(a, b) ? new_true() : new_nil();
 }
 
-#define _ORD_(name, cmp)                                       \
-    static ptr name(ptr a)                                     \
-    {                                                          \
-        if (kind(a) == T_NIL)                                  \
-        {                                                      \
-            return new_true();                                 \
-        }                                                      \
-        assert(kind(a) == T_CON);                              \
-        ptr b = get_tail(a);                                   \
-        if (kind(b) != T_NIL)                                  \
-        {                                                      \
-            if (get_int(get_head(a)) cmp get_int(get_head(b))) \
-            {                                                  \
-                return name(b);                                \
-            }                                                  \
-            else                                               \
-            {                                                  \
-                return new_nil();                              \
-            }                                                  \
-        }                                                      \
-        else                                                   \
-        {                                                      \
-            return new_true();                                 \
-        }                                                      \
+/* compares two ints, which can be bignums */
+static int compare(ptr a, ptr b)
+{
+    if (kind(a) == T_BIG || kind(b) == T_BIG)
+    {
+        return big_cmp(a, b);
+    }
+    i64 x = get_int(a);
+    i64 y = get_int(b);
+    return (x > y) - (x < y);
+}
+
+#define _ORD_(name, cmp)                                        \
+    static ptr name(ptr a)                                      \
+    {                                                           \
+        if (kind(a) == T_NIL)                                   \
+        {                                                       \
+            return new_true();                                  \
+        }                                                       \
+        assert(kind(a) == T_CON);                               \
+        ptr b = get_tail(a);                                    \
+        if (kind(b) != T_NIL)                                   \
+        {                                                       \
+            if (compare(get_head(a), get_head(b)) cmp 0)        \
+            {                                                   \
+                return name(b);                                 \
+            }                                                   \
+            else                                                \
+            {                                                   \
+                return new_nil();                               \
+            }                                                   \
+        }                                                       \
+        else                                                    \
+        {                                                       \
+            return new_true();                                  \
+        }                                                       \
     }
 _ORD_(lt, <)
 _ORD_(gt, >)
 _ORD_(lte, <=)
 _ORD_(gte, >=)
 
-#define _ARITH_(name, op, init)                \
-    static ptr name(ptr a)                     \
-    {                                          \
-        i64 val = init;                        \
-        while (kind(a) == T_CON)               \
-        {                                      \
-            val = val op get_int(get_head(a)); \
-            a = get_tail(a);                   \
-        }                                      \
-        return new_int(val);                   \
+/*
+folds the rest of the arguments into `val` with a bignum operation,
+once the arithmetic on i64 overflowed or met a bignum
+*/
+static ptr big_fold(ptr (*op)(ptr, ptr), i64 val, ptr args)
+{
+    i64 scope = scope_begin();
+    ptr acc = new_int(val);
+    root(&acc);
+    for (; kind(args) == T_CON; args = get_tail(args))
+    {
+        acc = op(acc, get_head(args));
+    }
+    scope_end(scope);
+    return acc;
+}
+
+// the arguments are folded on i64 as long as that does not overflow
+#define _ARITH_(name, checked_op, big_op, init)                              \
+    static ptr name(ptr a)                                                   \
+    {                                                                        \
+        i64 val = init;                                                      \
+        for (; kind(a) == T_CON; a = get_tail(a))                            \
+        {                                                                    \
+            i64 next;                                                        \
+            ptr arg = get_head(a);                                           \
+            if (kind(arg) == T_BIG || checked_op(val, get_int(arg), &next))  \
+            {                                                                \
+                return big_fold(big_op, val, a);                             \
+            }                                                                \
+            val = next;                                                      \
+        }                                                                    \
+        return new_int(val);                                                 \
     }
-_ARITH_(sum, +, 0)
-_ARITH_(prod, *, 1)
+_ARITH_(sum, __builtin_add_overflow, big_add, 0)
+_ARITH_(prod, __builtin_mul_overflow, big_mul, 1)
 
 static ptr minus(ptr i)
 {
     ptr arg0 = get_head(i);
+    ptr arg1 = arg0;
     if (kind(get_tail(i)) != T_NIL)
     {
-        ptr arg1 = elem(1, i);
-        return new_int(get_int(arg0) - get_int(arg1));
+        arg1 = elem(1, i);
     }
     else
     {
-        return new_int(-get_int(arg0));
+        arg0 = new_int(0);
     }
+    i64 diff;
+    if (kind(arg0) == T_BIG || kind(arg1) == T_BIG ||
+        __builtin_sub_overflow(get_int(arg0), get_int(arg1), &diff))
+    {
+        return big_sub(arg0, arg1);
+    }
+    return new_int(diff);
 }
 
-static ptr div(ptr i)
+static ptr b_div(ptr i)
 {
-    return new_int(get_int(elem(0, i)) / get_int(elem(1, i)));
+    ptr a = elem(0, i);
+    ptr b = elem(1, i);
+    // the quotient of the smallest i64 and -1 is the only one that overflows
+    if (kind(a) == T_BIG || kind(b) == T_BIG || (get_int(a) == INT64_MIN && get_int(b) == -1))
+    {
+        return big_div(a, b);
+    }
+    assert(get_int(b) != 0 && "division by zero");
+    return new_int(get_int(a) / get_int(b));
 }
 
 static ptr mod(ptr i)
 {
-    return new_int(get_int(elem(0, i)) % get_int(elem(1, i)));
+    ptr a = elem(0, i);
+    ptr b = elem(1, i);
+    if (kind(a) == T_BIG || kind(b) == T_BIG || (get_int(a) == INT64_MIN && get_int(b) == -1))
+    {
+        return big_mod(a, b);
+    }
+    assert(get_int(b) != 0 && "division by zero");
+    return new_int(get_int(a) % get_int(b));
 }
 
 #define _CMP_(name, _kind)             \
@@ -118,9 +204,17 @@ static ptr mod(ptr i)
         }                              \
     }
 _CMP_(is_nil, T_NIL)
-_CMP_(is_int, T_INT)
 _CMP_(is_sym, T_SYM)
 _CMP_(is_pair, T_CON)
+_CMP_(is_str, T_STR)
+_CMP_(is_vector, T_VEC)
+_CMP_(is_hash, T_MAP)
+
+static ptr is_int(ptr i)
+{
+    i = get_head(i);
+    return kind(i) == T_INT || kind(i) == T_BIG ? new_true() : new_nil();
+}
 
 static ptr is_list(ptr i)
 {
@@ -153,6 +247,12 @@ static ptr apply_quasiquote(ptr i, int depth)
     case T_INT:
     case T_FUN:
     case T_MAC:
+    case T_SPC:
+    case T_ENV:
+    case T_STR:
+    case T_VEC:
+    case T_MAP:
+    case T_BIG:
         return i;
     case T_CON:
     {
@@ -170,16 +270,19 @@ static ptr apply_quasiquote(ptr i, int depth)
         {
             depth++;
         }
+        i64 scope = scope_begin();
+        root(&i);
+        root(&head);
+        root(&tail);
         ptr new_head = apply_quasiquote(head, depth);
+        root(&new_head);
         ptr new_tail = apply_quasiquote(tail, depth);
-        if (new_head == head && new_tail == tail)
-        {
-            return i;
-        }
-        else
+        if (new_head != head || new_tail != tail)
         {
-            return new_cons(new_head, new_tail);
+            i = new_cons(new_head, new_tail);
         }
+        scope_end(scope);
+        return i;
     }
     default:
         failwith("unreachable");
@@ -191,32 +294,26 @@ static ptr eval_quasiquote(ptr i)
     return apply_quasiquote(i, 1);
 }
 
+/* returns the code of the first branch whose condition holds */
 static ptr eval_cond(ptr i)
 {
-    if (kind(i) == T_NIL)
-    {
-        return i;
-    }
-    else
+    while (kind(i) != T_NIL)
     {
         assert(kind(i) == T_CON);
 
         ptr branch = get_head(i);
-        ptr rest = get_tail(i);
 
         ptr cond = elem(0, branch);
         ptr code = elem(1, branch);
 
         cond = eval(cond);
-        if (kind(cond) == T_NIL)
+        if (kind(cond) != T_NIL)
         {
-            return eval_cond(rest);
-        }
-        else
-        {
-            return eval(code);
+            return code;
         }
+        i = get_tail(i);
     }
+    return i;
 }
 
 static ptr cons(ptr i)
@@ -240,6 +337,10 @@ static ptr el(ptr i)
 {
     ptr idx = elem(0, i);
     ptr list = elem(1, i);
+    if (kind(list) == T_VEC)
+    {
+        return get_vector_item(list, get_int(idx));
+    }
     return elem(get_int(idx), list);
 }
 
@@ -265,9 +366,8 @@ static ptr concat_sym(ptr i)
         len += strlen(get_symbol_str(get_symbol(get_head(cursor))));
         cursor = get_tail(cursor);
     }
-    assert(len < SYM_SIZE);
-
-    char buf[SYM_SIZE] = {0};
+    char buf[len + 1];
+    buf[0] = 0;
 
     cursor = i;
     while (kind(cursor) == T_CON)
@@ -279,21 +379,48 @@ static ptr concat_sym(ptr i)
     return new_symbol(buf);
 }
 
+/* returns a new symbol that is different from all others, it is collected when unused */
+static ptr gensym(ptr i)
+{
+    static i64 count = 0;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "#:g%ld", __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED));
+    (void)i;
+    return new_uninterned_symbol(buf);
+}
+
+/* evaluates all but the last form, which is returned to be evaluated in tail position */
 static ptr progn(ptr i)
 {
-    ptr result = new_nil();
-    while (kind(i) == T_CON)
+    if (kind(i) == T_NIL)
     {
-        result = get_head(i);
+        return i;
+    }
+    while (kind(get_tail(i)) == T_CON)
+    {
+        eval(get_head(i));
         i = get_tail(i);
     }
-    return result;
+    return get_head(i);
 }
 
 static ptr read(ptr i)
 {
     i = get_head(i);
 
+    if (kind(i) == T_STR)
+    {
+        // strings in mapped files are not zero terminated
+        char *buf = malloc((size_t)get_string_len(i) + 1);
+        assert(buf);
+        memcpy(buf, get_string(i), (size_t)get_string_len(i));
+        buf[get_string_len(i)] = 0;
+        char *cursor = buf;
+        ptr parsed = parse(&cursor);
+        free(buf);
+        return parsed;
+    }
+
     ptr cursor = i;
     i64 size = 0;
     while (kind(cursor) == T_CON)
@@ -320,9 +447,493 @@ static ptr read(ptr i)
     return parse(&buf_ptr);
 }
 
+static ptr str_len(ptr i)
+{
+    return new_int(get_string_len(elem(0, i)));
+}
+
+/* returns the byte at an index of a string */
+static ptr str_ref(ptr i)
+{
+    ptr str = elem(0, i);
+    i64 idx = get_int(elem(1, i));
+    assert(idx >= 0 && idx < get_string_len(str) && "string index out of range");
+    return new_int((unsigned char)get_string(str)[idx]);
+}
+
+/* returns a copy of the bytes of a string from the first index up to the second one */
+static ptr str_slice(ptr i)
+{
+    ptr str = elem(0, i);
+    i64 from = get_int(elem(1, i));
+    i64 to = get_int(elem(2, i));
+    assert(from >= 0 && from <= to && to <= get_string_len(str) && "string slice out of range");
+    return new_string(get_string(str) + from, to - from);
+}
+
+/*
+splits a string at each occurence of a delimiter string.
+the pieces are returned in a list, empty ones between adjacent delimiters included.
+*/
+static ptr str_split(ptr i)
+{
+    ptr str = elem(0, i);
+    ptr delim = elem(1, i);
+    i64 len = get_string_len(str);
+    i64 delim_len = get_string_len(delim);
+    assert(delim_len > 0 && "empty delimiter");
+
+    // the ends of the pieces are found first, so the list can be built from the back
+    i64 *ends = malloc(sizeof(i64) * (size_t)(len / delim_len + 1));
+    assert(ends);
+    i64 count = 0;
+    for (i64 k = 0; k + delim_len <= len;)
+    {
+        if (!memcmp(get_string(str) + k, get_string(delim), (size_t)delim_len))
+        {
+            ends[count++] = k;
+            k += delim_len;
+        }
+        else
+        {
+            k++;
+        }
+    }
+    ends[count++] = len;
+
+    i64 scope = scope_begin();
+    ptr pieces = new_nil();
+    root(&pieces);
+    for (i64 k = count - 1; k >= 0; k--)
+    {
+        i64 begin = k == 0 ? 0 : ends[k - 1] + delim_len;
+        ptr piece = new_string(get_string(str) + begin, ends[k] - begin);
+        pieces = new_cons(piece, pieces);
+    }
+    scope_end(scope);
+    free(ends);
+    return pieces;
+}
+
+/* parses a decimal integer surrounded by whitespace, returns nil if there is none */
+static ptr str_int(ptr i)
+{
+    char *c = get_string(elem(0, i));
+    char *end = c + get_string_len(elem(0, i));
+    while (c < end && (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r'))
+    {
+        c++;
+    }
+    while (end > c && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+    {
+        end--;
+    }
+    int negative = c < end && *c == '-';
+    if (negative)
+    {
+        c++;
+    }
+    if (c == end)
+    {
+        return new_nil();
+    }
+    char *digits = c;
+    i64 num = 0;
+    int overflow = false;
+    for (; c < end; c++)
+    {
+        if (*c < '0' || *c > '9')
+        {
+            return new_nil();
+        }
+        overflow |= __builtin_mul_overflow(num, 10, &num);
+        overflow |= __builtin_add_overflow(num, *c - '0', &num);
+    }
+    if (!overflow)
+    {
+        return new_int(negative ? -num : num);
+    }
+    // too long for an int
+    i64 scope = scope_begin();
+    ptr big = big_parse(digits, end - digits);
+    root(&big);
+    if (negative)
+    {
+        big = big_sub(new_int(0), big);
+    }
+    scope_end(scope);
+    return big;
+}
+
+/* returns the bytes of a string as a list of integers */
+static ptr str_to_list(ptr i)
+{
+    ptr str = elem(0, i);
+    i64 scope = scope_begin();
+    ptr list = new_nil();
+    root(&list);
+    for (i64 k = get_string_len(str) - 1; k >= 0; k--)
+    {
+        list = new_cons(new_int((unsigned char)get_string(str)[k]), list);
+    }
+    scope_end(scope);
+    return list;
+}
+
+/* returns a string of the bytes in a list of integers */
+static ptr list_to_str(ptr i)
+{
+    i = get_head(i);
+    i64 len = 0;
+    for (ptr cursor = i; kind(cursor) == T_CON; cursor = get_tail(cursor))
+    {
+        len++;
+    }
+    char *buf = malloc((size_t)len + 1);
+    assert(buf);
+    i64 k = 0;
+    for (ptr cursor = i; kind(cursor) == T_CON; cursor = get_tail(cursor))
+    {
+        i64 byte = get_int(get_head(cursor));
+        assert(byte >= 0 && byte < 256 && "not a byte");
+        buf[k++] = (char)byte;
+    }
+    ptr str = new_string(buf, len);
+    free(buf);
+    return str;
+}
+
+static ptr make_vector(ptr i)
+{
+    return new_vector(get_int(elem(0, i)), elem(1, i));
+}
+
+/* returns a vector of its arguments */
+static ptr vector(ptr i)
+{
+    i64 len = 0;
+    for (ptr cursor = i; kind(cursor) == T_CON; cursor = get_tail(cursor))
+    {
+        len++;
+    }
+    ptr vec = new_vector(len, new_nil());
+    for (i64 k = 0; k < len; k++, i = get_tail(i))
+    {
+        set_vector_item(vec, k, get_head(i));
+    }
+    return vec;
+}
+
+static ptr vector_ref(ptr i)
+{
+    return get_vector_item(elem(0, i), get_int(elem(1, i)));
+}
+
+/* changes an element of a vector in place, returns the new element */
+static ptr vector_set(ptr i)
+{
+    ptr value = elem(2, i);
+    set_vector_item(elem(0, i), get_int(elem(1, i)), value);
+    return value;
+}
+
+static ptr vector_length(ptr i)
+{
+    return new_int(get_vector_len(elem(0, i)));
+}
+
+static ptr make_hash(ptr i)
+{
+    (void)i;
+    return new_map();
+}
+
+/* returns the value of a key, or the default value if there is one, or nil */
+static ptr hash_get(ptr i)
+{
+    ptr value = new_nil();
+    if (!map_get(elem(0, i), elem(1, i), &value) && kind(get_tail(get_tail(i))) == T_CON)
+    {
+        value = elem(2, i);
+    }
+    return value;
+}
+
+/* binds a key to a value in place, returns the value */
+static ptr hash_put(ptr i)
+{
+    ptr value = elem(2, i);
+    map_put(elem(0, i), elem(1, i), value);
+    return value;
+}
+
+static ptr hash_has(ptr i)
+{
+    ptr value = new_nil();
+    return map_get(elem(0, i), elem(1, i), &value) ? new_true() : new_nil();
+}
+
+static ptr hash_remove(ptr i)
+{
+    return map_remove(elem(0, i), elem(1, i)) ? new_true() : new_nil();
+}
+
+static ptr hash_count(ptr i)
+{
+    return new_int(map_count(elem(0, i)));
+}
+
+/* returns the keys and values of a map as a list of pairs, in no particular order */
+static ptr hash_entries(ptr i)
+{
+    ptr map = elem(0, i);
+    i64 scope = scope_begin();
+    ptr entries = new_nil();
+    ptr key = new_nil();
+    ptr value = new_nil();
+    root(&entries);
+    root(&key);
+    root(&value);
+    for (i64 pos = map_next(map, 0, &key, &value); pos != -1; pos = map_next(map, pos, &key, &value))
+    {
+        entries = new_cons(new_list(2, key, value), entries);
+    }
+    scope_end(scope);
+    return entries;
+}
+
+/* returns the keys of a map, in no particular order */
+static ptr hash_keys(ptr i)
+{
+    ptr map = elem(0, i);
+    i64 scope = scope_begin();
+    ptr keys = new_nil();
+    ptr key = new_nil();
+    ptr value = new_nil();
+    root(&keys);
+    for (i64 pos = map_next(map, 0, &key, &value); pos != -1; pos = map_next(map, pos, &key, &value))
+    {
+        keys = new_cons(key, keys);
+    }
+    scope_end(scope);
+    return keys;
+}
+
+/*
+state of a memoized function, a vector of its cache, the memoized lambda
+and how often the cache was hit and missed.
+if the size of the cache is limited, the keys are kept in a vector as well,
+which is used as ring buffer to evict the oldest entry when the cache is full.
+*/
+#define MEMO_CACHE 0
+#define MEMO_FUN 1
+#define MEMO_HITS 2
+#define MEMO_MISSES 3
+#define MEMO_KEYS 4
+#define MEMO_NEXT_KEY 5
+#define MEMO_STATE_LEN 6
+
+// builtins that memoized functions call, they are set when they are registered
+static ptr memo_call_fn = 0;
+static ptr list_fn = 0;
+
+static void count(ptr state, i64 counter)
+{
+    set_vector_item(state, counter, new_int(get_int(get_vector_item(state, counter)) + 1));
+}
+
+/*
+calls a memoized lambda, unless its cache has the result for
+arguments that are `=` to these already.
+`pmap` workers may call it at the same time, so the cache and the counts are
+changed under the shared lock, but the lambda runs without it
+*/
+static ptr memo_call(ptr i)
+{
+    ptr state = elem(0, i);
+    ptr args = elem(1, i);
+    ptr result = new_nil();
+    lock_shared();
+    int hit = map_get(get_vector_item(state, MEMO_CACHE), args, &result);
+    count(state, hit ? MEMO_HITS : MEMO_MISSES);
+    unlock_shared();
+    if (hit)
+    {
+        return result;
+    }
+
+    i64 scope = scope_begin();
+    root(&result);
+    ptr fun = get_vector_item(state, MEMO_FUN);
+    result = vm_enabled() ? vm_apply(fun, args) : apply(fun, args);
+    lock_shared();
+    ptr cache = get_vector_item(state, MEMO_CACHE);
+    ptr keys = get_vector_item(state, MEMO_KEYS);
+    ptr cached = new_nil();
+    if (kind(keys) == T_VEC && !map_get(cache, args, &cached))
+    {
+        // recursive calls or other threads may have cached the same arguments already
+        i64 next = get_int(get_vector_item(state, MEMO_NEXT_KEY));
+        if (map_count(cache) == get_vector_len(keys))
+        {
+            map_remove(cache, get_vector_item(keys, next));
+        }
+        set_vector_item(keys, next, args);
+        set_vector_item(state, MEMO_NEXT_KEY, new_int((next + 1) % get_vector_len(keys)));
+    }
+    map_put(cache, args, result);
+    unlock_shared();
+    scope_end(scope);
+    return result;
+}
+
+/*
+returns a lambda that caches the results of a lambda,
+all of them or, if a limit is passed, the most recent ones.
+it takes the same arguments and passes them to `memo-call` with its state.
+*/
+static ptr memo(ptr i)
+{
+    ptr fun = elem(0, i);
+    assert(kind(fun) == T_CON && is_lambda(get_head(fun)) && "only lambdas can be memoized");
+
+    i64 scope = scope_begin();
+    ptr state = new_vector(MEMO_STATE_LEN, new_int(0));
+    root(&state);
+    set_vector_item(state, MEMO_CACHE, new_map());
+    set_vector_item(state, MEMO_FUN, fun);
+    set_vector_item(state, MEMO_KEYS, new_nil());
+    if (kind(get_tail(i)) == T_CON)
+    {
+        i64 max = get_int(elem(1, i));
+        assert(max > 0);
+        set_vector_item(state, MEMO_KEYS, new_vector(max, new_nil()));
+    }
+
+    // the builtins are called by value, so formal arguments can not shadow them
+    ptr formals = elem(1, fun);
+    ptr args = new_cons(list_fn, formals);
+    root(&args);
+    ptr body = new_list(3, memo_call_fn, state, args);
+    ptr memoized = new_list(3, get_head(fun), formals, body);
+    scope_end(scope);
+    return memoized;
+}
+
+/* returns the hits, misses and entries of the cache of a memoized function */
+static ptr memo_stats(ptr i)
+{
+    ptr body = elem(2, elem(0, i));
+    assert(kind(body) == T_CON && get_head(body) == memo_call_fn && "not a memoized function");
+    ptr state = elem(1, body);
+    return new_list(3, get_vector_item(state, MEMO_HITS), get_vector_item(state, MEMO_MISSES),
+                    new_int(map_count(get_vector_item(state, MEMO_CACHE))));
+}
+
+/* the optional number of threads of `pmap` and `pfilter`, 0 for one per core */
+static i64 thread_count(ptr i)
+{
+    return kind(get_tail(get_tail(i))) == T_CON ? get_int(elem(2, i)) : 0;
+}
+
+/* maps a function over a list on worker threads, see par.c */
+static ptr pmap(ptr i)
+{
+    return par_map(elem(0, i), elem(1, i), thread_count(i), false);
+}
+
+static ptr pfilter(ptr i)
+{
+    return par_map(elem(0, i), elem(1, i), thread_count(i), true);
+}
+
+/* collects all garbage, returns the pause in microseconds */
+static ptr b_gc(ptr i)
+{
+    (void)i;
+    return new_int(full_gc());
+}
+
+/* sets the threads of full collections, returns the previous number */
+static ptr gc_threads(ptr i)
+{
+    return new_int(set_gc_threads(get_int(elem(0, i))));
+}
+
+/* sets the pause budget of incremental collections, returns the previous one */
+static ptr gc_pause_budget(ptr i)
+{
+    return new_int(set_pause_budget(get_int(elem(0, i))));
+}
+
+static ptr gc_pauses(ptr i)
+{
+    (void)i;
+    return pause_stats();
+}
+
+/* wall clock time in milliseconds, for timing benchmarks */
+static ptr b_clock(ptr i)
+{
+    (void)i;
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return new_int((i64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+position of the reader in the input file.
+the input is read front to back with `read-line`, `next-byte` and `peek-byte`,
+so only the parts that are being worked on have to be turned into values
+*/
+static i64 input_cursor = 0;
+
+/* returns the next line of the input without the newline, or nil at its end */
+static ptr read_line(ptr i)
+{
+    (void)i;
+    i64 len = 0;
+    char *input = get_input(&len);
+    if (input_cursor == len)
+    {
+        return new_nil();
+    }
+    char *begin = input + input_cursor;
+    char *newline = memchr(begin, '\n', (size_t)(len - input_cursor));
+    i64 line_len = newline ? newline - begin : len - input_cursor;
+    input_cursor += newline ? line_len + 1 : line_len;
+    return new_string(begin, line_len);
+}
+
+/* returns the next byte of the input, or nil at its end */
+static ptr next_byte(ptr i)
+{
+    (void)i;
+    i64 len = 0;
+    char *input = get_input(&len);
+    if (input_cursor == len)
+    {
+        return new_nil();
+    }
+    return new_int((unsigned char)input[input_cursor++]);
+}
+
+/* returns the next byte of the input without consuming it, or nil at its end */
+static ptr peek_byte(ptr i)
+{
+    (void)i;
+    i64 len = 0;
+    char *input = get_input(&len);
+    if (input_cursor == len)
+    {
+        return new_nil();
+    }
+    return new_int((unsigned char)input[input_cursor]);
+}
+
 static ptr b_eval(ptr i)
 {
-    return eval(get_head(i));
+    return eval_in(get_head(i), new_nil());
 }
 
 static ptr is_builtin_fun(ptr i)
@@ -336,8 +947,10 @@ void register_builtins(void)
 
     #define new_builtin_mc(a, b) new_builtin(a, b, T_MAC)
     #define new_builtin_fn(a, b) new_builtin(a, b, T_FUN)
+    #define new_builtin_sp(a, b) new_builtin(a, b, T_SPC)
 
-    new_builtin_mc(&eval_cond, "cond");
+    new_builtin_sp(&eval_cond, "cond");
+    new_builtin_sp(&progn, "progn");
     new_builtin_mc(&eval_quasiquote, "quasiquote");
     new_builtin_mc(&eval_quote, "quote");
 
@@ -351,7 +964,7 @@ void register_builtins(void)
     new_builtin_fn(&sum, "+");
     new_builtin_fn(&prod, "*");
     new_builtin_fn(&minus, "-");
-    new_builtin_fn(&div, "/");
+    new_builtin_fn(&b_div, "/");
     new_builtin_fn(&mod, "%");
 
     new_builtin_fn(&is_nil, "nil?");
@@ -359,22 +972,65 @@ void register_builtins(void)
     new_builtin_fn(&is_sym, "sym?");
     new_builtin_fn(&is_pair, "pair?");
     new_builtin_fn(&is_list, "list?");
+    new_builtin_fn(&is_str, "str?");
+    new_builtin_fn(&is_vector, "vector?");
+    new_builtin_fn(&is_hash, "hash?");
     new_builtin_fn(&is_builtin_fun, "bfun?");
 
     new_builtin_fn(&read, "read");
 
     new_builtin_fn(&cons, "cons");
-    new_builtin_fn(&list, "list");
+    list_fn = new_builtin_fn(&list, "list");
     new_builtin_fn(&head, "hd");
     new_builtin_fn(&tail, "tl");
     new_builtin_fn(&el, "el");
 
+    new_builtin_fn(&str_len, "str-len");
+    new_builtin_fn(&str_ref, "str-ref");
+    new_builtin_fn(&str_slice, "str-slice");
+    new_builtin_fn(&str_split, "str-split");
+    new_builtin_fn(&str_int, "str-int");
+    new_builtin_fn(&str_to_list, "str->list");
+    new_builtin_fn(&list_to_str, "list->str");
+
+    new_builtin_fn(&make_vector, "make-vector");
+    new_builtin_fn(&vector, "vector");
+    new_builtin_fn(&vector_ref, "vector-ref");
+    new_builtin_fn(&vector_set, "vector-set!");
+    new_builtin_fn(&vector_length, "vector-length");
+
+    new_builtin_fn(&make_hash, "make-hash");
+    new_builtin_fn(&hash_get, "hash-get");
+    new_builtin_fn(&hash_put, "hash-put!");
+    new_builtin_fn(&hash_has, "hash-has?");
+    new_builtin_fn(&hash_remove, "hash-remove!");
+    new_builtin_fn(&hash_count, "hash-count");
+    new_builtin_fn(&hash_entries, "hash-entries");
+    new_builtin_fn(&hash_keys, "hash-keys");
+
+    new_builtin_fn(&memo, "memo");
+    memo_call_fn = new_builtin_fn(&memo_call, "memo-call");
+    new_builtin_fn(&memo_stats, "memo-stats");
+
+    new_builtin_fn(&pmap, "pmap");
+    new_builtin_fn(&pfilter, "pfilter");
+    new_builtin_fn(&b_clock, "clock");
+    new_builtin_fn(&b_gc, "gc");
+    new_builtin_fn(&gc_threads, "gc-threads");
+    new_builtin_fn(&gc_pause_budget, "gc-pause-budget");
+    new_builtin_fn(&gc_pauses, "gc-pauses");
+
+    new_builtin_fn(&read_line, "read-line");
+    new_builtin_fn(&next_byte, "next-byte");
+    new_builtin_fn(&peek_byte, "peek-byte");
+
     new_builtin_fn(&panic, "panic");
     new_builtin_fn(&concat_sym, "symcat");
-    new_builtin_fn(&progn, "progn");
+    new_builtin_fn(&gensym, "gensym");
 
     new_builtin_fn(&b_eval, "eval");
 
     #undef new_builtin_mc
     #undef new_builtin_fn
+    #undef new_builtin_sp
 }
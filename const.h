@@ -1,17 +1,63 @@
 #ifndef __CONST_H__
 #define __CONST_H__
 
-// number of "values" that can be stored in the interpreter
-#define MEM_LEN 10000000
+// maximal number of "values" that can be stored in the interpreter
+// only address space is reserved for them, memory is used as the heap grows
+#define MEM_LEN (1 << 27)
+
+// initial number of "values" in the heap, and by how many it grows or shrinks
+#define HEAP_INIT_LEN (1 << 18)
+#define HEAP_CHUNK_LEN (1 << 18)
 
 // maximal usage in percent:
 // this is to avoid repeatedly running the garbage collector to free 
 // only a few values, and instead notice that we should increase the memory size.
+// below a quarter of it, memory is given back.
 #define MAX_MEMORY_USAGE 60
 
-// number of symbols that can be defined
-#define SYM_LEN 1024
-#define SYM_SIZE 16
+// nodes are allocated by bumping a cursor through blocks of this many nodes
+#define BLOCK_LEN (1 << 14)
+
+// nodes that are allocated before the young generation is collected.
+// under a pause budget the nursery shrinks down to NURSERY_MIN_LEN nodes,
+// until a minor collection fits into the budget
+#define NURSERY_LEN (1 << 20)
+#define NURSERY_MIN_LEN (1 << 16)
+
+// bytes of strings and vectors that are allocated before the young generation
+// is collected, unless more than that survived the last collection
+#define LARGE_NURSERY_BYTES (1 << 24)
+
+// size of the chunks the names of symbols are allocated from
+#define SYM_NAMES_CHUNK (1 << 16)
+
+// functions whose body has at most this many atoms are inlined when they are
+// called with simple arguments, and inlined bodies are inlined into this deep
+#define INLINE_MAX_SIZE 8
+#define INLINE_MAX_DEPTH 4
+
+// worker threads that `pmap` and `pfilter` can use, and the size of their C stacks
+#define MAX_THREADS 64
+#define THREAD_STACK_SIZE (1 << 26)
+
+// threads that mark and sweep in a full collection or a step of one, which is serial below
+// a heap of PARALLEL_GC_MIN_LEN nodes. sweeping threads take SWEEP_CHUNK blocks
+// at a time, marking threads start with deques of DEQUE_INIT_CAP nodes
+#define MAX_GC_THREADS 16
+#define PARALLEL_GC_MIN_LEN (1 << 20)
+#define SWEEP_CHUNK 16
+#define DEQUE_INIT_CAP (1 << 12)
+
+// full collections are incremental, with pauses of at most about this many
+// microseconds, unless it is 0. a pause marks up to MARK_STEP_NODES nodes
+// or sweeps up to SWEEP_STEP_BLOCKS blocks (on each of the gc threads),
+// whenever a thread takes a new block
+#define GC_PAUSE_BUDGET 1000
+#define MARK_STEP_NODES (1 << 16)
+#define SWEEP_STEP_BLOCKS 64
+
+// file the stacks of `--profile` are written to
+#define PROFILE_PATH "profile.folded"
 
 // number of builtin functions that can be defined
 #define MAX_BUILTINS 100
@@ -1,135 +1,351 @@
+#include <stdlib.h>
+
 #include "lisp.h"
 #include "assert.h"
 
 static int debug = 0;
 
-static ptr beta_reduce(ptr code, ptr formal_arg, ptr arg, int quote_depth)
+// whether the calls of lambdas are profiled, see prof.c
+static int profiling = false;
+
+void eval_profile(void)
 {
-    switch (kind(code))
-    {
-    case T_SYM:
-        if (get_symbol(code) == get_symbol(formal_arg) && !quote_depth)
-        {
-            return quoted(arg);
-        }
-        return code;
-    case T_CON:
+    profile_enable();
+    profiling = true;
+}
+
+/*
+environment the current expression is evaluated in
+nil stands for the global environment, i.e. the symbol table.
+every thread evaluates in its own environment
+*/
+static _Thread_local ptr env = 0;
+
+ptr get_env(void)
+{
+    return env;
+}
+
+ptr *env_location(void)
+{
+    return &env;
+}
+
+/*
+looks up the value of a symbol
+first in the lexical environment frames, then in the global bindings
+*/
+static ptr lookup(ptr symbol)
+{
+    for (ptr e = env; kind(e) == T_ENV; e = get_parent(e))
     {
-        ptr hd = get_head(code);
-        if (is_quote(hd))
+        ptr frame = get_frame(e);
+        ptr formal_args = get_head(frame);
+        ptr values = get_tail(frame);
+        while (kind(formal_args) == T_CON)
         {
-            if (quote_depth)
+            if (get_head(formal_args) == symbol)
             {
-                return quoted(beta_reduce(elem(1, code), formal_arg, arg, quote_depth));
-            }
-            else
-            {
-                return code;
+                return get_head(values);
             }
+            formal_args = get_tail(formal_args);
+            values = get_tail(values);
         }
-        if (is_unquote(hd))
+    }
+    return get_symbol_binding(get_symbol(symbol));
+}
+
+/*
+environment a function closes over
+lambdas evaluated inside of another function carry it as fourth element
+*/
+static ptr closure_env(ptr fun)
+{
+    ptr rest = get_tail(get_tail(get_tail(fun)));
+    if (kind(rest) == T_CON)
+    {
+        return get_head(rest);
+    }
+    return new_nil();
+}
+
+/* captures the current environment in a lambda or macro expression */
+static ptr make_closure(ptr fun_head, ptr formal_args, ptr fun_body, ptr closed_env)
+{
+    return new_list(4, fun_head, formal_args, fun_body, closed_env);
+}
+
+/*
+expansions of macro calls, cached by call site.
+the call site is the form of the call, which is looked up by identity,
+the expansion is reused as long as the macro is the same.
+the forms are not roots, the entries of forms that were freed are dropped.
+the cache is shared by all threads.
+*/
+typedef struct
+{
+    ptr call;
+    ptr macro;
+    ptr expansion;
+} expansion_t;
+
+static expansion_t *expansions = NULL;
+static i64 expansions_cap = 0;
+static i64 expansions_len = 0;
+
+/* slot of the entry of a call, or the empty slot where it belongs */
+static i64 expansion_slot(expansion_t *table, i64 cap, ptr call)
+{
+    i64 mask = cap - 1;
+    i64 slot = (i64)(((uint64_t)call * 0x9e3779b97f4a7c15u) >> 32) & mask;
+    // nil is never a call, it marks empty slots
+    while (table[slot].call && table[slot].call != call)
+    {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* moves the entries of live calls into a new table of `cap` slots */
+static void rehash_expansions(i64 cap)
+{
+    expansion_t *table = calloc((size_t)cap, sizeof(expansion_t));
+    assert(table);
+    expansions_len = 0;
+    for (i64 k = 0; k < expansions_cap; k++)
+    {
+        expansion_t *e = &expansions[k];
+        if (e->call && is_live(e->call))
         {
-            ptr body = get_tail(code);
-            assert(quote_depth);
-            body = beta_reduce(body, formal_arg, arg, quote_depth - 1);
-            // TODO no copying if same
-            return new_cons(hd, body);
+            table[expansion_slot(table, cap, e->call)] = *e;
+            expansions_len++;
         }
-        else if (is_quasiquote(hd))
+    }
+    free(expansions);
+    expansions = table;
+    expansions_cap = cap;
+}
+
+static int find_expansion(ptr call, ptr macro, ptr *expansion)
+{
+    int found = false;
+    lock_shared();
+    if (expansions_len)
+    {
+        expansion_t *e = &expansions[expansion_slot(expansions, expansions_cap, call)];
+        if (e->call == call && e->macro == macro)
         {
-            ptr body = get_tail(code);
-            body = beta_reduce(body, formal_arg, arg, quote_depth + 1);
-            // TODO no copying if same
-            return new_cons(hd, body);
+            *expansion = e->expansion;
+            found = true;
         }
-        if (is_functionlike(hd) && !quote_depth)
-        {
-            ptr arg_list = elem(1, code);
-            ptr fun_body = elem(2, code);
+    }
+    unlock_shared();
+    return found;
+}
 
-            ptr cursor = arg_list;
-            while (kind(cursor) == T_CON)
-            {
-                ptr fun_arg = elem(0, cursor);
-                if (fun_arg == formal_arg)
-                {
-                    return code;
-                }
-                cursor = get_tail(cursor);
-            }
-            fun_body = beta_reduce(fun_body, formal_arg, arg, quote_depth);
-            return new_list(3, hd, arg_list, fun_body);
-        }
-        else
-        {
-            ptr head = get_head(code);
-            ptr tail = get_tail(code);
+static void save_expansion(ptr call, ptr macro, ptr expansion)
+{
+    lock_shared();
+    if (2 * (expansions_len + 1) > expansions_cap)
+    {
+        rehash_expansions(expansions_cap ? 2 * expansions_cap : 1024);
+    }
+    expansion_t *e = &expansions[expansion_slot(expansions, expansions_cap, call)];
+    if (!e->call)
+    {
+        expansions_len++;
+    }
+    *e = (expansion_t){call, macro, expansion};
+    unlock_shared();
+}
 
-            ptr new_head = beta_reduce(head, formal_arg, arg, quote_depth);
-            ptr new_tail = beta_reduce(tail, formal_arg, arg, quote_depth);
+/* the cached expansions and their macros are kept alive */
+void eval_mark_roots(void (*mark)(ptr))
+{
+    for (i64 k = 0; k < expansions_cap; k++)
+    {
+        if (expansions[k].call)
+        {
+            mark(expansions[k].macro);
+            mark(expansions[k].expansion);
+        }
+    }
+}
 
-            if (new_head == head && new_tail == tail)
-            {
-                return code;
-            }
-            else
-            {
-                return new_cons(new_head, new_tail);
-            }
+/* drops the expansions of calls that were freed */
+void eval_sweep(void)
+{
+    for (i64 k = 0; k < expansions_cap; k++)
+    {
+        if (expansions[k].call && !is_live(expansions[k].call))
+        {
+            rehash_expansions(expansions_cap);
+            return;
         }
     }
-    default:
-        return code;
+}
+
+static ptr reverse(ptr list)
+{
+    i64 scope = scope_begin();
+    ptr reversed = new_nil();
+    root(&list);
+    root(&reversed);
+    while (kind(list) == T_CON)
+    {
+        reversed = new_cons(get_head(list), reversed);
+        list = get_tail(list);
     }
+    scope_end(scope);
+    return reversed;
 }
 
-ptr eval_elems(ptr is);
-ptr eval(ptr i)
+/*
+binds the formal arguments of a function to the passed arguments
+in a new frame on top of the closure environment.
+the formal arguments for which `..` was passed are returned,
+they are the arguments of the partially applied function.
+*/
+static ptr bind_args(ptr formal_args, ptr args, ptr parent)
 {
-    if (debug)
+    int partial = false;
+    ptr f_cursor = formal_args;
+    ptr a_cursor = args;
+    while (kind(f_cursor) != T_NIL)
     {
-        printf("[DEBUG] ");
-        println(i);
+        partial |= is_partial_app(get_head(a_cursor));
+        f_cursor = get_tail(f_cursor);
+        a_cursor = get_tail(a_cursor);
     }
-    switch (kind(i))
+
+    if (!partial)
     {
-    case T_FUN:
-    case T_MAC:
-    case T_NIL:
-    case T_INT:
-        return i;
-    case T_SYM:
+        env = new_env(formal_args, args, parent);
+        return new_nil();
+    }
+
+    i64 scope = scope_begin();
+    ptr partial_args = new_nil();
+    ptr bound_args = new_nil();
+    ptr bound_values = new_nil();
+    root(&formal_args);
+    root(&args);
+    root(&parent);
+    root(&partial_args);
+    root(&bound_args);
+    root(&bound_values);
+
+    while (kind(formal_args) != T_NIL)
     {
-        ptr sym = get_symbol(i);
-        ptr bind = get_symbol_binding(sym);
-        if (kind(bind) == T_POO)
+        ptr f_arg = get_head(formal_args);
+        ptr c_arg = get_head(args);
+
+        if (is_partial_app(c_arg))
+        {
+            partial_args = new_cons(f_arg, partial_args);
+        }
+        else
         {
-            printf("`%s` is unbound.\n", get_symbol_str(sym));
-            assert(false);
+            bound_args = new_cons(f_arg, bound_args);
+            bound_values = new_cons(c_arg, bound_values);
         }
-        return bind;
+
+        formal_args = get_tail(formal_args);
+        args = get_tail(args);
     }
-    case T_CON:
+
+    bound_args = reverse(bound_args);
+    bound_values = reverse(bound_values);
+    env = new_env(bound_args, bound_values, parent);
+    partial_args = reverse(partial_args);
+    scope_end(scope);
+    return partial_args;
+}
+
+ptr eval_elems(ptr is);
+
+/*
+evaluates an expression, leaving `env` at the environment of the last tail call.
+calls in tail position (function bodies, special forms and macro expansions)
+replace `i` and `env` and loop instead of recursing, so they use no C stack.
+the GC roots of the locals are left on the root stack, `eval` removes them.
+when profiling, `profiled` is set once a call of a lambda began, and `eval` ends it.
+*/
+static ptr eval_tail(ptr i, int *profiled)
+{
+    ptr fun = new_nil();
+    ptr args = new_nil();
+    ptr caller_env = new_nil();
+    ptr call = new_nil();
+    root(&i);
+    root(&fun);
+    root(&args);
+    root(&caller_env);
+    root(&call);
+
+    while (true)
     {
+        if (debug)
+        {
+            printf("[DEBUG] ");
+            println(i);
+        }
+        switch (kind(i))
+        {
+        case T_FUN:
+        case T_MAC:
+        case T_SPC:
+        case T_NIL:
+        case T_INT:
+        case T_STR:
+        case T_VEC:
+        case T_MAP:
+        case T_BIG:
+            return i;
+        case T_SYM:
+        {
+            ptr bind = lookup(i);
+            if (kind(bind) == T_POO)
+            {
+                printf("`%s` is unbound.\n", get_symbol_str(get_symbol(i)));
+                assert(false);
+            }
+            return bind;
+        }
+        case T_CON:
+            break;
+        default:
+            failwith("unreachable");
+        }
+
         ptr head = get_head(i);
+        fun = new_nil();
+        args = new_nil();
+        caller_env = new_nil();
         if (is_functionlike(head))
         {
-            return i;
+            if (kind(env) == T_NIL)
+            {
+                return i;
+            }
+            return make_closure(head, elem(1, i), elem(2, i), env);
         }
         if (is_definition(head))
         {
             ptr name = elem(1, i);
             ptr def = elem(2, i);
-            def = eval(def);
+            def = optimize_definition(name, eval(def));
             new_binding(name, def);
             return new_nil();
         }
-        ptr fun = eval(head);
-        ptr args = get_tail(i);
+        fun = eval(head);
+        args = get_tail(i);
 
         if (kind(fun) == T_FUN)
         {
-            return get_fn_ptr(fun)(eval_elems(args));
+            // builtins get their arguments rooted
+            args = eval_elems(args);
+            return get_fn_ptr(fun)(args);
         }
 
         if (kind(fun) == T_MAC)
@@ -137,6 +353,12 @@ ptr eval(ptr i)
             return get_fn_ptr(fun)(args);
         }
 
+        if (kind(fun) == T_SPC)
+        {
+            i = get_fn_ptr(fun)(args);
+            continue;
+        }
+
         if (is_pragma(fun))
         {
             debug = 1;
@@ -164,69 +386,149 @@ ptr eval(ptr i)
         {
             // argument evaluation
             args = eval_elems(args);
+
+            if (vm_enabled())
+            {
+                return vm_apply(fun, args);
+            }
+        }
+
+        ptr expansion = new_nil();
+        if (is_macro(fun_head) && find_expansion(i, fun, &expansion))
+        {
+            i = expansion;
+            continue;
         }
 
         ptr formal_args = elem(1, fun);
         ptr fun_body = elem(2, fun);
 
-        // TODO Partial app
-        int partial_args_len = 0;
-        ptr partial_args[10];
+        call = i;
+        caller_env = env;
+        ptr partial_args = bind_args(formal_args, args, closure_env(fun));
 
-        while (kind(formal_args) != T_NIL)
+        // in this case we just return a different lambda
+        if (kind(partial_args) != T_NIL)
         {
-            ptr f_arg = get_head(formal_args);
-            ptr c_arg = get_head(args);
-
-            if (is_partial_app(c_arg))
-            {
-                partial_args[partial_args_len++] = f_arg;
-                assert(partial_args_len < 10);
-            }
-            else
-            {
-                fun_body = beta_reduce(fun_body, f_arg, c_arg, false);
-            }
-
-            formal_args = get_tail(formal_args);
-            args = get_tail(args);
+            return make_closure(fun_head, partial_args, fun_body, env);
         }
 
-        // in this case we just return a different lambda
-        if (partial_args_len > 0)
+        if (is_macro(fun_head))
+        {
+            // the expansion is evaluated in place of the macro call
+            i = eval(fun_body);
+            env = caller_env;
+            i = optimize(i, new_nil(), env);
+            save_expansion(call, fun, i);
+        }
+        else
         {
-            ptr new_formal_args = new_nil();
-            while (partial_args_len)
+            if (profiling)
             {
-                new_formal_args = new_cons(partial_args[--partial_args_len], new_formal_args);
+                // a tail call takes the place of the call it is made from
+                if (*profiled)
+                {
+                    profile_return();
+                }
+                profile_call(fun);
+                *profiled = true;
             }
-            return new_cons(fun_head, new_cons(new_formal_args, new_cons(fun_body, new_nil())));
+            i = fun_body;
         }
+    }
+}
 
-        if (is_macro(fun_head))
-        {
-            // macro expansion
-            fun_body = eval(fun_body);
-        }
+ptr eval(ptr i)
+{
+    i64 scope = scope_begin();
+    ptr outer_env = env;
+    root(&outer_env);
+    int profiled = false;
+    ptr result = eval_tail(i, &profiled);
+    if (profiled)
+    {
+        profile_return();
+    }
+    env = outer_env;
+    scope_end(scope);
+    return result;
+}
+
+ptr eval_in(ptr i, ptr e)
+{
+    i64 scope = scope_begin();
+    ptr outer_env = env;
+    root(&outer_env);
+    env = e;
+    ptr result = eval(i);
+    env = outer_env;
+    scope_end(scope);
+    return result;
+}
 
-        return eval(fun_body);
+ptr apply(ptr fun, ptr args)
+{
+    if (kind(fun) == T_FUN)
+    {
+        return get_fn_ptr(fun)(args);
+    }
+    i64 scope = scope_begin();
+    ptr outer_env = env;
+    root(&outer_env);
+    root(&fun);
+    ptr partial_args = bind_args(elem(1, fun), args, closure_env(fun));
+    ptr result;
+    if (kind(partial_args) != T_NIL)
+    {
+        result = make_closure(elem(0, fun), partial_args, elem(2, fun), env);
     }
-    default:
-        failwith("unreachable");
+    else
+    {
+        int profiled = profiling;
+        if (profiled)
+        {
+            profile_call(fun);
+        }
+        result = eval(elem(2, fun));
+        if (profiled)
+        {
+            profile_return();
+        }
     }
+    env = outer_env;
+    scope_end(scope);
+    return result;
+}
+
+ptr expand_macro(ptr macro, ptr args)
+{
+    i64 scope = scope_begin();
+    ptr outer_env = env;
+    root(&outer_env);
+    root(&macro);
+    bind_args(elem(1, macro), args, closure_env(macro));
+    ptr expansion = eval(elem(2, macro));
+    env = outer_env;
+    scope_end(scope);
+    return expansion;
 }
 
 ptr eval_elems(ptr is)
 {
     if (kind(is) == T_CON)
     {
+        i64 scope = scope_begin();
         ptr head = get_head(is);
         ptr tail = get_tail(is);
+        root(&tail);
 
         ptr eval_head = eval(head);
-        ptr eval_tail = eval_elems(tail);
+        root(&eval_head);
+        ptr evaled_tail = eval_elems(tail);
 
-        return new_cons(eval_head, eval_tail);
+        ptr result = new_cons(eval_head, evaled_tail);
+        scope_end(scope);
+        return result;
     }
     else
     {
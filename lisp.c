@@ -5,8 +5,6 @@
 #include "lisp.h"
 #include "assert.h"
 
-#define LISP_LEN (1 << 20)
-
 static int iter = 1;
 
 int get_iter(void)
@@ -14,47 +12,87 @@ int get_iter(void)
     return iter;
 }
 
-i64 *stack_top;
-
-int main(void)
+/*
+parses and evaluates every expression of a lisp source file
+and prints the results.
+the file is mapped, so string literals can point into it
+*/
+static void run_file(char *path)
 {
-    i64 dummy = 0xC0FFEE;
-    stack_top = &dummy;
-
-    // lisp source to be interpreted
-    static char lisp[LISP_LEN] = {0};
-
-    FILE *f = fopen("lisp", "rb");
-    assert(f);
-
-    fseek(f, 0, SEEK_END);
-    size_t fsize = (size_t)ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    assert(fsize < LISP_LEN);
-
-    fread(lisp, fsize, 1, f);
-    fclose(f);
-    lisp[fsize] = 0;
-
-    init();
-    // dump();
-
-    char *lisp_ptr = &lisp[0];
+    i64 len = 0;
+    char *lisp_ptr = map_file(path, &len);
     char **cursor = &lisp_ptr;
 
+    strip(cursor);
     while (**cursor)
     {
         ptr parsed = parse(cursor);
-        ptr evaled = eval(parsed);
+        ptr evaled = vm_enabled() ? vm_eval(parsed) : eval(parsed);
         println(evaled);
         strip(cursor);
         iter++;
     }
+}
+
+/*
+interprets the lisp files given as arguments in order,
+or the `lisp` file if there are none.
+with `--vm` the files are run by the bytecode VM instead of the tree walker,
+with `--stats` the totals of the memory manager are printed to stderr at the end,
+with `--profile` the calls of lambdas by the tree walker are counted and timed,
+see prof.c.
+*/
+int main(int argc, char **argv)
+{
+    init();
+    // dump();
+
+    int files = 0;
+    int stats = false;
+    for (int k = 1; k < argc; k++)
+    {
+        if (!strcmp(argv[k], "--vm"))
+        {
+            vm_enable();
+        }
+        else if (!strcmp(argv[k], "--stats"))
+        {
+            stats = true;
+        }
+        else if (!strcmp(argv[k], "--profile"))
+        {
+            eval_profile();
+        }
+        else
+        {
+            files++;
+        }
+    }
+
+    if (files == 0)
+    {
+        run_file("lisp");
+    }
+    for (int k = 1; k < argc; k++)
+    {
+        if (strcmp(argv[k], "--vm") && strcmp(argv[k], "--stats") && strcmp(argv[k], "--profile"))
+        {
+            run_file(argv[k]);
+        }
+    }
+
+    if (stats)
+    {
+        print_mem_stats();
+    }
+    if (profile_enabled())
+    {
+        profile_report();
+    }
 
     gc();
 
-    int memory = mem_usage();
+    i64 memory = mem_usage();
     char *unit[] = {"", "K", "M", "G", "T"};
     char **mem_unit = &unit[0];
     while (memory >= (1 << 13))
@@ -63,7 +101,7 @@ int main(void)
         memory /= 1024;
     }
 
-    printf("We used %d%sB of memory for the lisp values\n", memory, *mem_unit);
+    printf("We used %ld%sB of memory for the lisp values\n", memory, *mem_unit);
 
     return 0;
 }
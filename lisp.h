@@ -1,6 +1,7 @@
 #ifndef __LISP_DEFS_H__
 #define __LISP_DEFS_H__
 
+#include <stddef.h>
 #include <stdint.h>
 #include "const.h"
 
@@ -18,13 +19,32 @@ typedef int64_t i64;
 #define T_EMT 5 // empty
 #define T_FUN 6 // builtin function
 #define T_MAC 7 // builtin macro
+#define T_ENV 8 // environment frame
+#define T_SPC 9 // builtin special form, returns code to evaluate in tail position
+#define T_STR 10 // byte string
+#define T_VEC 11 // vector
+#define T_MAP 12 // hash map
+#define T_BIG 13 // integer that does not fit into an i64
 
+// lisp values are tagged:
+// integers that fit into 63 bits are immediates, `(value << 1) | 1`,
+// all other values refer to a node by `index << 1`. nil is node 0.
+#define is_immediate(i) ((i) & 1)
+#define node_ref(index) ((ptr)(index) << 1)
+#define node_index(i) ((i) >> 1)
+
+// table of a hash map, see map.c
+typedef struct map map_t;
+// magnitude of a bignum, see big.c
+typedef struct big big_t;
+
+// the kind and GC mark of a node are kept in arrays next to the heap
 typedef struct
 {
     // Contents of a node
     union
     {
-        // integer value
+        // integer value, if it does not fit into an immediate
         i64 value;
         struct
         {
@@ -34,27 +54,55 @@ typedef struct
             ptr tail;
         };
 
+        struct
+        {
+            // cons of the formal arguments and the values bound to them
+            ptr frame;
+            // enclosing environment, nil if it is the global one
+            ptr parent;
+        };
+
+        struct
+        {
+            // contents of a string. they are owned by the node and zero terminated,
+            // unless they point into a mapped file
+            char *bytes;
+            // length of the string without the terminating zero
+            i64 bytes_len;
+        };
+
+        struct
+        {
+            // elements of a vector, owned by the node
+            ptr *items;
+            i64 items_len;
+        };
+
+        // entries of a hash map, owned by the node
+        map_t *map;
+
+        // digits of a bignum, owned by the node
+        big_t *big;
+
         // pointer to the symbol
         ptr symbol;
 
-        // if builtin function or macro, function pointer
+        // if builtin function, macro or special form, function pointer
         ptr (*builtin)(ptr);
 
-        // if not in use, point to next free node
-        ptr next_free;
         ptr _data[2];
     };
-    // GC data
-    i64 gc;
-    // kind of node
-    i64 kind;
 } node_t;
 
 typedef struct
 {
     ptr binding;
     ptr node;
-    char name[SYM_SIZE];
+    uint64_t hash;
+    // interned names live in an arena, uninterned ones are freed with the symbol
+    char *name;
+    // uninterned symbols are not in the hash index and are collected
+    int interned;
 } sym_t;
 
 void init(void);
@@ -69,11 +117,52 @@ ptr new_nil(void);
 ptr new_list(int len, ...);
 ptr new_true(void);
 ptr new_symbol(char *symbol);
+ptr new_uninterned_symbol(char *name);
 ptr new_builtin(ptr (*fun)(ptr), char *sym, int kind);
+ptr new_env(ptr formal_args, ptr values, ptr parent);
+ptr new_string(char *bytes, i64 len);
+ptr new_vector(i64 len, ptr init);
+ptr new_map(void);
+ptr new_big(big_t *b);
 ptr quoted(ptr i);
 
 // garbage collection
 void gc(void);
+// full collection from lisp code, returns the pause in microseconds
+i64 full_gc(void);
+// threads of a full collection of a large heap, returns the previous number
+i64 set_gc_threads(i64 threads);
+// upper bound of the pauses of incremental collections in microseconds,
+// 0 to collect the old generation in one pause. returns the previous one
+i64 set_pause_budget(i64 budget);
+// list of the number, the longest, the 99th percentile and the sum of the pauses
+// for collections in microseconds since the last call
+ptr pause_stats(void);
+// memory outside of the heap that is owned by a node, may collect garbage
+void *alloc_large(size_t size);
+void free_large(void *memory, size_t size);
+// has to be called after changing node `i` to point to `value`
+void write_barrier(ptr i, ptr value);
+
+// GC roots: C variables holding lisp values across allocations
+// have to be registered with `root` between `scope_begin` and `scope_end`
+i64 scope_begin(void);
+void root(ptr *var);
+void scope_end(i64 scope);
+
+// threads: the heap is shared by worker threads between `parallel_begin`
+// and `parallel_end`, which the main thread calls while no worker runs.
+// workers run lisp code between `thread_attach` and `thread_detach`
+void parallel_begin(void);
+void parallel_end(void);
+void thread_attach(void);
+void thread_detach(void);
+// guards tables that are shared by the threads, while workers run
+void lock_shared(void);
+void unlock_shared(void);
+// applies `fun` to the elements of `list` on `threads` threads, 0 for one per core.
+// if `filter` is set, returns the elements for which it is not nil
+ptr par_map(ptr fun, ptr list, i64 threads, int filter);
 
 // get kind of data
 i64 kind(ptr i);
@@ -84,16 +173,77 @@ ptr get_symbol(ptr i);
 ptr get_nil(ptr i);
 ptr get_head(ptr i);
 ptr get_tail(ptr i);
+ptr get_frame(ptr i);
+ptr get_parent(ptr i);
+char *get_string(ptr i);
+i64 get_string_len(ptr i);
+ptr get_vector_item(ptr i, i64 idx);
+void set_vector_item(ptr i, i64 idx, ptr value);
+i64 get_vector_len(ptr i);
+map_t *get_map(ptr i);
+big_t *get_big(ptr i);
 ptr elem(int idx, ptr node);
 char *get_symbol_str(ptr s);
 ptr get_symbol_binding(ptr s);
 ptr (*get_fn_ptr(ptr i))(ptr);
 
-int mem_usage(void);
+i64 mem_usage(void);
+i64 heap_size(void);
+// one line of totals since the start: nodes allocated, collections,
+// time paused for them and the largest heap, as `key=value` pairs on stderr
+void print_mem_stats(void);
+// nodes the calling thread has allocated so far
+i64 thread_allocated(void);
+// whether a value was not freed by the last collection
+int is_live(ptr i);
+i64 symbol_count(void);
 
 // eval an expression
 // might have side effects
 ptr eval(ptr i);
+// eval an expression in the given environment
+ptr eval_in(ptr i, ptr env);
+// environment the interpreter is currently evaluating in
+ptr get_env(void);
+// address of the environment of the calling thread, which the GC marks
+ptr *env_location(void);
+// apply a builtin function or a lambda to evaluated arguments
+ptr apply(ptr fun, ptr args);
+// profile the calls of lambdas from now on
+void eval_profile(void);
+// evaluate the body of a macro with the unevaluated arguments bound,
+// returns the expansion
+ptr expand_macro(ptr macro, ptr args);
+// called by the garbage collector, for the cached macro expansions
+void eval_mark_roots(void (*mark)(ptr));
+void eval_sweep(void);
+
+// folds constants, inlines small functions and drops dead `cond` clauses in an expression,
+// `formals` and the frames of `env` are bound locally where it is evaluated
+ptr optimize(ptr i, ptr formals, ptr env);
+// optimizes the body of a lambda that is bound to `name`
+ptr optimize_definition(ptr name, ptr value);
+
+// profiler of the lambdas the tree walker calls, see prof.c
+void profile_enable(void);
+int profile_enabled(void);
+// names a lambda after the symbol it is bound to
+void profile_name(ptr symbol, ptr value);
+// a call of a lambda begins, or the last one that began on this thread ends
+void profile_call(ptr fun);
+void profile_return(void);
+// prints the calls, times and nodes of the functions to stderr,
+// and writes the folded stacks to PROFILE_PATH
+void profile_report(void);
+
+// bytecode compiler and VM, replaces the tree walker when enabled
+void vm_enable(void);
+int vm_enabled(void);
+ptr vm_eval(ptr i);
+ptr vm_apply(ptr fun, ptr args);
+// called by the garbage collector
+void vm_mark_roots(void (*mark)(ptr));
+void vm_sweep(void);
 
 int is_quote(ptr i);
 int is_quasiquote(ptr i);
@@ -105,19 +255,51 @@ int is_definition(ptr i);
 int is_partial_app(ptr i);
 int is_pragma(ptr i);
 
+// symbols the interpreter itself uses, interned at startup
+ptr quote_symbol(void);
+ptr unquote_symbol(void);
+ptr quasiquote_symbol(void);
+ptr lambda_symbol(void);
+ptr macro_symbol(void);
+ptr definition_symbol(void);
+ptr partial_app_symbol(void);
+ptr pragma_symbol(void);
+
 void print(ptr i);
 void println(ptr i);
 void dump(void);
 
+// hash maps, the map, key and value have to be rooted
+map_t *map_create(void);
+void map_destroy(map_t *m);
+void map_mark(map_t *m, void (*mark)(ptr));
+int map_get(ptr map, ptr key, ptr *value);
+void map_put(ptr map, ptr key, ptr value);
+int map_remove(ptr map, ptr key);
+i64 map_count(ptr map);
+// iterates over the entries, starting with position 0 until -1 is returned
+i64 map_next(ptr map, i64 pos, ptr *key, ptr *value);
+int c_eq(ptr a, ptr b);
+
+// bignums, the arguments can also be ints and have to be rooted.
+// results that fit into an i64 are ints
+ptr big_add(ptr a, ptr b);
+ptr big_sub(ptr a, ptr b);
+ptr big_mul(ptr a, ptr b);
+ptr big_div(ptr a, ptr b);
+ptr big_mod(ptr a, ptr b);
+int big_cmp(ptr a, ptr b);
+uint64_t big_hash(ptr i);
+ptr big_parse(char *digits, i64 len);
+void big_print(ptr i);
+void big_destroy(big_t *b);
+
 // parsing
+char *map_file(char *path, i64 *len);
+char *get_input(i64 *len);
 ptr parse(char **input);
 void strip(char **input);
 
 int get_iter(void);
 
-extern i64 *stack_top;
-
-extern void stack_search(void);
-void stack_search_impl(void);
-
 #endif
@@ -0,0 +1,246 @@
+#include <string.h>
+
+#include "lisp.h"
+#include "assert.h"
+
+/*
+hash maps from lisp values to lisp values.
+keys are compared like `=` does, so ints, symbols, strings and
+structurally equal lists and vectors find the same entry.
+the entries live in the large object space, in a table with
+open addressing and linear probing, which doubles when it is 3/4 full.
+*/
+
+// slots that never held an entry, and slots whose entry was removed.
+// they can not be confused with keys, as node references are even
+#define EMPTY_KEY ((ptr)-2)
+#define REMOVED_KEY ((ptr)-4)
+
+#define MAP_INIT_CAP 8
+
+typedef struct
+{
+    ptr key;
+    ptr value;
+    uint64_t hash;
+} entry_t;
+
+struct map
+{
+    entry_t *entries;
+    i64 cap;
+    // entries in use, and slots that are taken by removed entries
+    i64 len;
+    i64 removed;
+};
+
+static uint64_t mix(uint64_t hash, uint64_t value)
+{
+    hash ^= value + 0x9e3779b97f4a7c15u + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+/* hash of a value, values that are `=` have the same hash */
+static uint64_t hash(ptr i)
+{
+    uint64_t h = (uint64_t)kind(i);
+    // lists are hashed in a loop, so only their nesting uses the C stack
+    while (kind(i) == T_CON)
+    {
+        h = mix(h, hash(get_head(i)));
+        i = get_tail(i);
+    }
+    switch (kind(i))
+    {
+    case T_INT:
+        return mix(h, (uint64_t)get_int(i));
+    case T_BIG:
+        return mix(h, big_hash(i));
+    case T_SYM:
+        return mix(h, (uint64_t)get_symbol(i));
+    case T_STR:
+    {
+        uint64_t fnv = 14695981039346656037u;
+        char *bytes = get_string(i);
+        for (i64 k = 0; k < get_string_len(i); k++)
+        {
+            fnv ^= (uint8_t)bytes[k];
+            fnv *= 1099511628211u;
+        }
+        return mix(h, fnv);
+    }
+    case T_VEC:
+        for (i64 k = 0; k < get_vector_len(i); k++)
+        {
+            h = mix(h, hash(get_vector_item(i, k)));
+        }
+        return h;
+    case T_MAP:
+        // maps are only equal to themselves
+        return mix(h, (uint64_t)i);
+    default:
+        // nil, and kinds that are rarely keys
+        return h;
+    }
+}
+
+map_t *map_create(void)
+{
+    map_t *m = alloc_large(sizeof(map_t));
+    m->entries = NULL;
+    m->cap = 0;
+    m->len = 0;
+    m->removed = 0;
+    return m;
+}
+
+void map_destroy(map_t *m)
+{
+    free_large(m->entries, (size_t)m->cap * sizeof(entry_t));
+    free_large(m, sizeof(map_t));
+}
+
+void map_mark(map_t *m, void (*mark)(ptr))
+{
+    for (i64 k = 0; k < m->cap; k++)
+    {
+        entry_t *e = &m->entries[k];
+        if (e->key != EMPTY_KEY && e->key != REMOVED_KEY)
+        {
+            mark(e->key);
+            mark(e->value);
+        }
+    }
+}
+
+/* slot of the entry with the key, or the empty slot where it would be */
+static i64 find_slot(map_t *m, ptr key, uint64_t h)
+{
+    i64 mask = m->cap - 1;
+    for (i64 slot = (i64)h & mask;; slot = (slot + 1) & mask)
+    {
+        entry_t *e = &m->entries[slot];
+        if (e->key == EMPTY_KEY)
+        {
+            return slot;
+        }
+        if (e->key != REMOVED_KEY && e->hash == h && c_eq(e->key, key))
+        {
+            return slot;
+        }
+    }
+}
+
+/* moves the entries into a new table of `cap` slots, dropping the removed ones */
+static void resize(ptr map, i64 cap)
+{
+    entry_t *entries = alloc_large((size_t)cap * sizeof(entry_t));
+    // allocating may have collected garbage, but not moved the map
+    map_t *m = get_map(map);
+    for (i64 k = 0; k < cap; k++)
+    {
+        entries[k].key = EMPTY_KEY;
+    }
+    entry_t *old = m->entries;
+    i64 old_cap = m->cap;
+    m->entries = entries;
+    m->cap = cap;
+    m->removed = 0;
+    for (i64 k = 0; k < old_cap; k++)
+    {
+        if (old[k].key != EMPTY_KEY && old[k].key != REMOVED_KEY)
+        {
+            m->entries[find_slot(m, old[k].key, old[k].hash)] = old[k];
+        }
+    }
+    free_large(old, (size_t)old_cap * sizeof(entry_t));
+}
+
+int map_get(ptr map, ptr key, ptr *value)
+{
+    map_t *m = get_map(map);
+    if (m->len == 0)
+    {
+        return false;
+    }
+    entry_t *e = &m->entries[find_slot(m, key, hash(key))];
+    if (e->key == EMPTY_KEY)
+    {
+        return false;
+    }
+    *value = e->value;
+    return true;
+}
+
+void map_put(ptr map, ptr key, ptr value)
+{
+    map_t *m = get_map(map);
+    if (4 * (m->len + m->removed + 1) > 3 * m->cap)
+    {
+        // a table that is mostly removed entries is cleaned up, not grown
+        i64 cap = m->cap ? m->cap : MAP_INIT_CAP;
+        while (4 * (m->len + 1) > 3 * cap / 2)
+        {
+            cap *= 2;
+        }
+        resize(map, cap);
+        m = get_map(map);
+    }
+    uint64_t h = hash(key);
+    entry_t *e = &m->entries[find_slot(m, key, h)];
+    if (e->key == EMPTY_KEY)
+    {
+        e->key = key;
+        e->hash = h;
+        m->len++;
+    }
+    e->value = value;
+    if (!is_immediate(key))
+    {
+        write_barrier(map, key);
+    }
+    if (!is_immediate(value))
+    {
+        write_barrier(map, value);
+    }
+}
+
+int map_remove(ptr map, ptr key)
+{
+    map_t *m = get_map(map);
+    if (m->len == 0)
+    {
+        return false;
+    }
+    entry_t *e = &m->entries[find_slot(m, key, hash(key))];
+    if (e->key == EMPTY_KEY)
+    {
+        return false;
+    }
+    e->key = REMOVED_KEY;
+    e->value = new_nil();
+    m->len--;
+    m->removed++;
+    return true;
+}
+
+i64 map_count(ptr map)
+{
+    return get_map(map)->len;
+}
+
+i64 map_next(ptr map, i64 pos, ptr *key, ptr *value)
+{
+    map_t *m = get_map(map);
+    for (; pos < m->cap; pos++)
+    {
+        entry_t *e = &m->entries[pos];
+        if (e->key != EMPTY_KEY && e->key != REMOVED_KEY)
+        {
+            *key = e->key;
+            *value = e->value;
+            return pos + 1;
+        }
+    }
+    return -1;
+}
@@ -1,26 +1,234 @@
+#define _DEFAULT_SOURCE
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lisp.h"
 #include "assert.h"
 
-static node_t mem[MEM_LEN] = {0};
-static ptr empty = 0;
+/*
+the heap: MEM_LEN nodes of address space are reserved up front,
+but only the first `heap_len` of them are backed by memory.
+the heap grows and shrinks in chunks of HEAP_CHUNK_LEN nodes.
+the kind and the mark of a node are kept in byte arrays next to it,
+so a node is only its two words of contents.
+*/
+static node_t *mem = NULL;
+static uint8_t *kinds = NULL;
+static uint8_t *marks = NULL;
+static i64 heap_len = 0;
+
+#define NODE(i) (mem[node_index(i)])
+#define KIND(i) (kinds[node_index(i)])
+#define MARK(i) (marks[node_index(i)])
+
+/* range of integers that are stored as immediates */
+#define FIXNUM_MIN (-((i64)1 << 62))
+#define FIXNUM_MAX (((i64)1 << 62) - 1)
+
+/*
+the symbol table grows as symbols are added, in address space that is reserved
+up front like the heap, so it never moves while other threads read it.
+the entries of collected uninterned symbols are reused.
+*/
+static sym_t *symbols = NULL;
+static i64 symbols_len = 0;
+static i64 symbols_cap = 0;
+
+static i64 *free_symbols = NULL;
+static i64 free_symbols_len = 0;
+static i64 free_symbols_cap = 0;
+
+/*
+hash index of the interned symbols, open addressing with linear probing.
+a slot holds the index of a symbol plus one, 0 is an empty slot.
+it is kept at most half full.
+*/
+static i64 *symbol_index = NULL;
+static i64 symbol_index_len = 0;
+static i64 interned_len = 0;
+
+/*
+names of interned symbols, they are never freed.
+they are bump allocated from chunks, so they do not move.
+*/
+static char *names = NULL;
+static i64 names_len = 0;
+static i64 names_cap = 0;
+static i64 names_size = 0;
+
+/*
+a node with `MARK(i) == gen` has been marked in the current cycle.
+marks are sticky: a node that survived a collection stays marked until
+the next full collection, so marked nodes are the old generation and
+nodes allocated since the last collection (young ones) are unmarked (0).
+after a full collection all nodes carry the mark of that cycle,
+so it is enough for `gen` to alternate between 1 and 2.
+*/
+static uint8_t gen = 1;
+
+#define BLOCKS (MEM_LEN / BLOCK_LEN)
+
+/* number of nodes in use per block */
+static i64 block_used[BLOCKS] = {0};
+
+/* blocks that were allocated into since the last collection */
+static i64 young_blocks[BLOCKS] = {0};
+static i64 young_len = 0;
+
+/* blocks that a thread allocates into, no other thread allocates there */
+static uint8_t block_owned[BLOCKS] = {0};
+
+/*
+blocks from the high water mark on have never been allocated into.
+their nodes are only marked as free when a thread takes the block,
+so the heap is not touched before it is used.
+*/
+static i64 high_water = 0;
+
+/* nodes in use after the last full collection */
+static i64 used_after_full = 0;
+
+/*
+full collections are incremental cycles while the pause budget is not 0.
+a cycle marks a bit at a time, whenever a thread takes a new block.
+while it marks, new nodes are allocated marked (black), and values stored
+into nodes are pushed to the mark stack (gray) by the constructors and the
+write barrier, so a marked node never points to an unmarked (white) one.
+the roots have no barrier, they are marked again whenever the mark stack runs empty,
+marking ends once that finds no unmarked node.
+then the blocks are swept a bit at a time, or when a thread looks for free nodes.
+*/
+#define GC_IDLE 0
+#define GC_MARKING 1
+#define GC_SWEEPING 2
+static int cycle = GC_IDLE;
+static i64 pause_budget = GC_PAUSE_BUDGET;
+// nodes that are allocated before a minor collection
+static i64 nursery_len = NURSERY_LEN;
+
+// mark of new nodes, the mark of the cycle while marking, young otherwise
+static uint8_t alloc_mark = 0;
+
+// blocks that were not swept since marking ended, and the next one to sweep
+static uint8_t block_unswept[BLOCKS] = {0};
+static i64 sweep_cursor = 0;
+
+// pauses for collections in microseconds, since they were last reported
+static i64 *pauses = NULL;
+static i64 pauses_len = 0;
+static i64 pauses_cap = 0;
+
+// totals since the start for `--stats`: nodes allocated by threads that are gone,
+// collections, time paused for them in microseconds, and the largest heap
+static i64 detached_allocated = 0;
+static i64 minor_gcs = 0;
+static i64 full_gcs = 0;
+static i64 paused_us = 0;
+static i64 peak_heap_len = 0;
+
+/*
+state of a thread that runs lisp code: the main thread, and the workers
+of `pmap` while they run. each has its own rooted variables and allocates
+into a block of its own, so allocating a node takes no lock.
+*/
+typedef struct
+{
+    // stack of addresses of C variables that hold lisp values
+    ptr **roots;
+    i64 roots_len;
+    i64 roots_cap;
+    // bump allocation cursor and end of the block it owns, node indices
+    i64 alloc_cursor;
+    i64 alloc_limit;
+    // nodes allocated so far
+    i64 allocated;
+    // environment the thread evaluates in
+    ptr *env;
+} mutator_t;
+
+static mutator_t main_mutator = {0};
+static _Thread_local mutator_t *self = &main_mutator;
+static mutator_t *mutators[MAX_THREADS + 1] = {&main_mutator};
+static i64 mutators_len = 1;
+
+/* gives up the block of a thread, the rest of it is allocated by others */
+static void release_block(mutator_t *m)
+{
+    if (m->alloc_limit)
+    {
+        block_owned[(m->alloc_limit - 1) / BLOCK_LEN] = false;
+    }
+    m->alloc_cursor = m->alloc_limit;
+}
+
+/*
+while worker threads run, the tables that all threads share (free blocks,
+symbols, remembered nodes, large object accounting) are changed under `shared`.
+a thread that has to collect garbage stops the world: it waits until every
+other running thread is parked at a safepoint, which is when a thread takes
+a new block or allocates a large object. all lisp values of a thread are
+rooted there, so the collecting thread can mark them.
+`lock_shared` nests, so code that holds the lock can call functions that take it,
+like `map_put` in `memo-call`. nested calls do not stop or collect garbage.
+*/
+static pthread_mutex_t shared = PTHREAD_MUTEX_INITIALIZER;
+// calls of `lock_shared` of the thread that are not unlocked yet
+static _Thread_local i64 shared_depth = 0;
+static pthread_cond_t parked_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t resume_cond = PTHREAD_COND_INITIALIZER;
+static int parallel = false;
+// a thread waits for the others to stop, or collects
+static int stopping = false;
+// threads that run lisp code while workers run, and the ones of them that are parked
+static i64 running = 0;
+static i64 parked = 0;
 
-static sym_t symbols[SYM_LEN] = {0};
+/*
+the large object space: the contents of strings and vectors live
+outside of the heap and are freed together with their node.
+`large_bytes` are in use, `large_bytes_after_gc` were after the last collection.
+the threads that sweep in parallel free large objects, so it is changed atomically.
+*/
+static i64 large_bytes = 0;
+static i64 large_bytes_after_gc = 0;
+
+/*
+files that are mapped into memory.
+they stay mapped until the program exits,
+so strings can point into them instead of owning a copy.
+*/
+typedef struct
+{
+    char *begin;
+    char *end;
+} mapping_t;
+static mapping_t *mappings = NULL;
+static i64 mappings_len = 0;
 
 /*
 nodes that are reserved for builtin use
 should never be GC'ed
 */
-static ptr builtin_use;
+static i64 builtin_use;
 
 #define make(name)              \
     static ptr sym_##name = 0;  \
     int is_##name(ptr i)        \
     {                           \
         return i == sym_##name; \
+    }                           \
+    ptr name##_symbol(void)     \
+    {                           \
+        return sym_##name;      \
     }
 make(quote)
 make(unquote)
@@ -32,7 +240,8 @@ make(partial_app)
 make(pragma)
 #undef make
 
-#define UNBOUND 2
+/* node 1 is never allocated, symbols without a binding point to it */
+#define UNBOUND node_ref(1)
 
 int is_functionlike(ptr i)
 {
@@ -67,32 +276,189 @@ static void init_builtin_symbols(void)
 }
 
 /*
-reads the input file
+maps a file read-only into memory, followed by at least one zero byte.
+the pages past the end of the file come from an anonymous mapping,
+so a file that fills its last page is still zero terminated.
+*/
+char *map_file(char *path, i64 *len)
+{
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    struct stat st;
+    int err = fstat(fd, &st);
+    assert(!err);
+
+    size_t size = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char *buf = mmap(NULL, (size / page + 1) * page, PROT_READ,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(buf != MAP_FAILED);
+    if (size > 0)
+    {
+        char *file = mmap(buf, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        assert(file == buf);
+    }
+    close(fd);
+
+    mappings = realloc(mappings, sizeof(mapping_t) * (size_t)(mappings_len + 1));
+    assert(mappings);
+    mappings[mappings_len++] = (mapping_t){buf, buf + size};
+
+    *len = (i64)size;
+    return buf;
+}
+
+/* whether bytes are part of a mapped file */
+static int is_mapped(char *bytes)
+{
+    for (i64 k = 0; k < mappings_len; k++)
+    {
+        if (bytes >= mappings[k].begin && bytes <= mappings[k].end)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* contents of the input file */
+static char *input_bytes = NULL;
+static i64 input_len = 0;
+
+/*
+binds `input` to the contents of the input file.
+the string points into the mapped file, it is not copied
 */
 void read_input(void)
 {
-    FILE *f = fopen("input.txt", "rb");
-    assert(f);
+    input_bytes = map_file("input.txt", &input_len);
+    new_binding(new_symbol("input"), new_string(input_bytes, input_len));
+}
 
-    fseek(f, 0, SEEK_END);
-    size_t fsize = (size_t)ftell(f);
-    fseek(f, 0, SEEK_SET);
+char *get_input(i64 *len)
+{
+    *len = input_len;
+    return input_bytes;
+}
 
-    char *buf = malloc(fsize + 1);
-    assert(buf);
+/*
+backs the first `len` elements of a reserved array with memory,
+the ones from `len` to `old_len` are given back to the operating system.
+*/
+static void commit(void *array, size_t size, i64 old_len, i64 len)
+{
+    // the arrays are page aligned, the byte arrays are not necessarily
+    // resized at page boundaries
+    size_t page = 4096;
+    size_t old_end = ((size_t)old_len * size + page - 1) / page * page;
+    size_t end = ((size_t)len * size + page - 1) / page * page;
+    char *base = array;
+    int err = 0;
+    if (end > old_end)
+    {
+        err = mprotect(base + old_end, end - old_end, PROT_READ | PROT_WRITE);
+    }
+    else if (end < old_end)
+    {
+        err = madvise(base + end, old_end - end, MADV_DONTNEED);
+        err |= mprotect(base + end, old_end - end, PROT_NONE);
+    }
+    assert(!err);
+}
 
-    fread(buf, fsize, 1, f);
-    fclose(f);
-    buf[fsize] = 0;
+/*
+backs the first `len` nodes of the reserved address space with memory.
+nodes beyond it are given back to the operating system.
+*/
+static void resize(i64 len)
+{
+    assert(len % BLOCK_LEN == 0 && len <= MEM_LEN);
+    commit(mem, sizeof(node_t), heap_len, len);
+    commit(kinds, 1, heap_len, len);
+    commit(marks, 1, heap_len, len);
+    if (len < heap_len)
+    {
+        if (high_water > len)
+        {
+            high_water = len;
+        }
+    }
+    heap_len = len;
+    if (len > peak_heap_len)
+    {
+        peak_heap_len = len;
+    }
+}
+
+/* nodes in use */
+static i64 count_used(void)
+{
+    i64 used = 0;
+    for (i64 b = 0; b < heap_len / BLOCK_LEN; b++)
+    {
+        used += block_used[b];
+    }
+    return used;
+}
+
+/* heap size at which it is half full */
+static i64 target_len(void)
+{
+    i64 len = (2 * count_used() + HEAP_CHUNK_LEN - 1) / HEAP_CHUNK_LEN * HEAP_CHUNK_LEN;
+    if (len < HEAP_INIT_LEN)
+    {
+        len = HEAP_INIT_LEN;
+    }
+    return len < MEM_LEN ? len : MEM_LEN;
+}
 
-    ptr input = new_nil();
-    for (char *cursor = buf + fsize - 1; cursor >= buf; cursor--)
+/*
+grows the heap by at least one chunk
+does not return if the heap has reached its maximal size
+*/
+static void grow(void)
+{
+    i64 len = target_len();
+    if (len < heap_len + HEAP_CHUNK_LEN)
+    {
+        len = heap_len + HEAP_CHUNK_LEN;
+    }
+    if (len > MEM_LEN)
     {
-        input = new_cons(new_int(*cursor), input);
+        printf("Out of memory.\n");
+        exit(-1);
     }
-    new_binding(new_symbol("input"), input);
+    resize(len);
+}
 
-    free(buf);
+/* gives the empty blocks at the end of the heap back to the OS */
+static void shrink(void)
+{
+    i64 len = target_len();
+    i64 top = heap_len / BLOCK_LEN;
+    while (top > 0 && block_used[top - 1] == 0)
+    {
+        top--;
+    }
+    if (len < top * BLOCK_LEN)
+    {
+        len = (top * BLOCK_LEN + HEAP_CHUNK_LEN - 1) / HEAP_CHUNK_LEN * HEAP_CHUNK_LEN;
+    }
+    if (len >= heap_len)
+    {
+        return;
+    }
+    resize(len);
+    for (i64 t = 0; t < mutators_len; t++)
+    {
+        if (mutators[t]->alloc_limit > len)
+        {
+            // continue allocating at the start of the heap
+            release_block(mutators[t]);
+            mutators[t]->alloc_cursor = 0;
+            mutators[t]->alloc_limit = 0;
+        }
+    }
 }
 
 #define MEM_UNINIT 0
@@ -110,183 +476,1282 @@ void init(void)
     {
         failwith("already initialized or in the process of doing so");
     }
-    initialized = MEM_INITIALIZING;
-
-    mem[0].kind = T_NIL;
-
-    mem[1].kind = T_INT;
-    mem[1].value = 1;
-
-    assert(UNBOUND == 2);
-    mem[UNBOUND].kind = T_POO;
-
-    empty = 3;
-    for (int i = 3; i < MEM_LEN; ++i)
+    initialized = MEM_INITIALIZING;
+    set_gc_threads(sysconf(_SC_NPROCESSORS_ONLN));
+
+    mem = mmap(NULL, MEM_LEN * (sizeof(node_t) + 2), PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(mem != MAP_FAILED);
+    kinds = (uint8_t *)&mem[MEM_LEN];
+    marks = kinds + MEM_LEN;
+    resize(HEAP_INIT_LEN);
+    // every symbol has a node, so there are at most MEM_LEN of them
+    symbols = mmap(NULL, MEM_LEN * sizeof(sym_t), PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(symbols != MAP_FAILED);
+
+    KIND(new_nil()) = T_NIL;
+    KIND(UNBOUND) = T_POO;
+
+    main_mutator.alloc_cursor = 2;
+    main_mutator.alloc_limit = BLOCK_LEN;
+    main_mutator.env = env_location();
+    memset(&kinds[2], T_EMT, BLOCK_LEN - 2);
+    high_water = BLOCK_LEN;
+    block_owned[0] = true;
+    young_blocks[young_len++] = 0;
+    block_used[0] = 2;
+
+    init_builtin_symbols();
+    register_builtins();
+    builtin_use = main_mutator.alloc_cursor;
+    read_input();
+    initialized = MEM_INITIALIZED;
+}
+
+/* grows a dynamic array so that it can hold one more element */
+static void *reserve(void *array, i64 len, i64 *cap, size_t size)
+{
+    if (len < *cap)
+    {
+        return array;
+    }
+    *cap = *cap ? 2 * *cap : 1024;
+    array = realloc(array, (size_t)*cap * size);
+    assert(array);
+    return array;
+}
+
+/*
+old nodes that were changed to point to young nodes and
+symbols that were bound since the last collection.
+minor collections trace those in addition to the roots.
+*/
+static ptr *remembered = NULL;
+static i64 remembered_len = 0;
+static i64 remembered_cap = 0;
+
+static ptr *dirty_symbols = NULL;
+static i64 dirty_len = 0;
+static i64 dirty_cap = 0;
+
+static void mark(ptr i);
+
+/* while marking, a value that is stored into a node is marked gray */
+static void shade(ptr value)
+{
+    if (cycle == GC_MARKING && !is_immediate(value))
+    {
+        lock_shared();
+        mark(value);
+        unlock_shared();
+    }
+}
+
+/* has to be called after changing node `i` to point to `value` */
+void write_barrier(ptr i, ptr value)
+{
+    if (is_immediate(value))
+    {
+        return;
+    }
+    if (cycle == GC_MARKING)
+    {
+        // all nodes that survive the cycle are old, none has to be remembered
+        shade(value);
+        return;
+    }
+    // a node that is changed repeatedly, like a vector being filled, is remembered once
+    if (is_immediate(i) || MARK(i) != gen)
+    {
+        return;
+    }
+    lock_shared();
+    if (remembered_len == 0 || remembered[remembered_len - 1] != i)
+    {
+        remembered = reserve(remembered, remembered_len, &remembered_cap, sizeof(ptr));
+        remembered[remembered_len++] = i;
+    }
+    unlock_shared();
+}
+
+/*
+every thread has a stack of addresses of C variables that hold lisp values.
+values referenced only from the C stack are kept alive
+if the variable holding them is registered with `root`.
+*/
+
+/* begins a scope of rooted variables, returns the value to pass to `scope_end` */
+i64 scope_begin(void)
+{
+    return self->roots_len;
+}
+
+/* registers a variable as GC root until the enclosing scope ends */
+void root(ptr *var)
+{
+    mutator_t *m = self;
+    m->roots = reserve(m->roots, m->roots_len, &m->roots_cap, sizeof(ptr *));
+    m->roots[m->roots_len++] = var;
+}
+
+/* unregisters all variables rooted since the matching `scope_begin` */
+void scope_end(i64 scope)
+{
+    assert(scope >= 0 && scope <= self->roots_len);
+    self->roots_len = scope;
+}
+
+void lock_shared(void)
+{
+    if (parallel && shared_depth++ == 0)
+    {
+        int err = pthread_mutex_lock(&shared);
+        assert(!err);
+    }
+}
+
+void unlock_shared(void)
+{
+    if (parallel && --shared_depth == 0)
+    {
+        pthread_mutex_unlock(&shared);
+    }
+}
+
+/* waits until the collection of another thread is done, with the lock held */
+static void park(void)
+{
+    parked++;
+    pthread_cond_signal(&parked_cond);
+    while (stopping)
+    {
+        pthread_cond_wait(&resume_cond, &shared);
+    }
+    parked--;
+}
+
+/* stops if another thread collects garbage, with the lock held */
+static void safepoint(void)
+{
+    if (stopping)
+    {
+        park();
+    }
+}
+
+static i64 now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (i64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record_pause(i64 begin)
+{
+    pauses = reserve(pauses, pauses_len, &pauses_cap, sizeof(i64));
+    pauses[pauses_len++] = now_us() - begin;
+    paused_us += pauses[pauses_len - 1];
+}
+
+/*
+runs a collection, with the lock held.
+while workers run, the other threads are stopped at their safepoints first.
+if another thread is collecting already, this one waits for it instead
+*/
+static void stop_the_world(void (*collection)(void))
+{
+    i64 begin = now_us();
+    if (!parallel)
+    {
+        collection();
+        record_pause(begin);
+        return;
+    }
+    if (stopping)
+    {
+        park();
+        return;
+    }
+    stopping = true;
+    while (parked < running - 1)
+    {
+        pthread_cond_wait(&parked_cond, &shared);
+    }
+    // the collection frees large objects, which takes the lock
+    pthread_mutex_unlock(&shared);
+    collection();
+    pthread_mutex_lock(&shared);
+    record_pause(begin);
+    stopping = false;
+    pthread_cond_broadcast(&resume_cond);
+}
+
+void parallel_begin(void)
+{
+    assert(!parallel && mutators_len == 1);
+    parallel = true;
+    // the main thread waits for the workers, it does not run
+    running = 0;
+}
+
+void parallel_end(void)
+{
+    assert(parallel && mutators_len == 1);
+    parallel = false;
+}
+
+void thread_attach(void)
+{
+    assert(parallel);
+    mutator_t *m = calloc(1, sizeof(mutator_t));
+    assert(m);
+    m->env = env_location();
+    self = m;
+    lock_shared();
+    // a running collection does not know about this thread
+    while (stopping)
+    {
+        pthread_cond_wait(&resume_cond, &shared);
+    }
+    assert(mutators_len <= MAX_THREADS);
+    mutators[mutators_len++] = m;
+    running++;
+    unlock_shared();
+}
+
+void thread_detach(void)
+{
+    mutator_t *m = self;
+    lock_shared();
+    safepoint();
+    release_block(m);
+    detached_allocated += m->allocated;
+    for (i64 k = 0; k < mutators_len; k++)
+    {
+        if (mutators[k] == m)
+        {
+            mutators[k] = mutators[--mutators_len];
+            break;
+        }
+    }
+    running--;
+    pthread_cond_signal(&parked_cond);
+    unlock_shared();
+    free(m->roots);
+    free(m);
+    self = NULL;
+}
+
+/*
+nodes that were marked, but whose children were not yet.
+marking is iterative, so its C stack usage does not depend on the
+shape of the data, e.g. the length of a list.
+*/
+static ptr *mark_stack = NULL;
+static i64 mark_stack_len = 0;
+static i64 mark_stack_cap = 0;
+
+/*
+a full collection of a large heap is done by `gc_threads` threads:
+each marks a share of the roots and traces from the nodes it marked,
+then each sweeps regions of blocks it takes from a counter.
+the steps of an incremental cycle are done the same way, marking from
+shares of the mark stack and sweeping up to SWEEP_STEP_BLOCKS blocks each.
+a marking thread keeps the nodes whose children are not marked yet
+in a deque (Chase and Lev's), it pushes and pops at the bottom and
+threads that ran out of nodes steal from the top.
+a node is marked with an atomic exchange, so exactly one thread traces it.
+*/
+typedef struct
+{
+    ptr *items;
+    i64 cap;
+} deque_buf_t;
+
+typedef struct
+{
+    deque_buf_t *buf;
+    i64 top;
+    i64 bottom;
+    // buffers that the deque outgrew, stealing threads may read them until marking ends
+    deque_buf_t **old;
+    i64 old_len;
+    i64 old_cap;
+} deque_t;
+
+static i64 gc_threads = 1;
+static deque_t deques[MAX_GC_THREADS];
+// deque of the thread while it marks in parallel, NULL when marking alone
+static _Thread_local deque_t *deque = NULL;
+// marking threads that found no nodes to trace
+static i64 idle_markers = 0;
+// next block to sweep
+static i64 sweep_next = 0;
+// end of a step of an incremental cycle, 0 when the threads collect all at once
+static i64 step_deadline = 0;
+// blocks below this are swept by a step
+static i64 step_sweep_end = 0;
+
+/* the collecting thread runs phases of a collection together with helper threads */
+static pthread_t gc_helpers[MAX_GC_THREADS];
+static i64 gc_helpers_len = 0;
+static pthread_mutex_t gc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t phase_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t phase_done_cond = PTHREAD_COND_INITIALIZER;
+static void (*phase)(i64 id) = NULL;
+static i64 phase_id = 0;
+static i64 phase_threads = 0;
+static i64 phase_done = 0;
+
+static deque_buf_t *new_deque_buf(i64 cap)
+{
+    deque_buf_t *buf = malloc(sizeof(deque_buf_t));
+    assert(buf);
+    buf->items = malloc((size_t)cap * sizeof(ptr));
+    assert(buf->items);
+    buf->cap = cap;
+    return buf;
+}
+
+/* pushes a node at the bottom, only the owner of the deque does */
+static void deque_push(deque_t *d, ptr i)
+{
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    deque_buf_t *buf = d->buf;
+    if (b - t >= buf->cap)
+    {
+        deque_buf_t *bigger = new_deque_buf(2 * buf->cap);
+        for (i64 k = t; k < b; k++)
+        {
+            bigger->items[k & (bigger->cap - 1)] =
+                __atomic_load_n(&buf->items[k & (buf->cap - 1)], __ATOMIC_RELAXED);
+        }
+        d->old = reserve(d->old, d->old_len, &d->old_cap, sizeof(deque_buf_t *));
+        d->old[d->old_len++] = buf;
+        __atomic_store_n(&d->buf, bigger, __ATOMIC_RELEASE);
+        buf = bigger;
+    }
+    __atomic_store_n(&buf->items[b & (buf->cap - 1)], i, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+/* pops the node at the bottom, or returns nil if it is empty */
+static ptr deque_pop(deque_t *d)
+{
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    deque_buf_t *buf = d->buf;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_SEQ_CST);
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    if (t > b)
+    {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return new_nil();
+    }
+    ptr i = __atomic_load_n(&buf->items[b & (buf->cap - 1)], __ATOMIC_RELAXED);
+    if (t == b)
+    {
+        // the last node, a stealing thread may take it at the same time
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            i = new_nil();
+        }
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return i;
+}
+
+/* takes the node at the top of another thread's deque, or returns nil */
+static ptr deque_steal(deque_t *d)
+{
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+    if (t >= b)
+    {
+        return new_nil();
+    }
+    deque_buf_t *buf = __atomic_load_n(&d->buf, __ATOMIC_ACQUIRE);
+    ptr i = __atomic_load_n(&buf->items[t & (buf->cap - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        return new_nil();
+    }
+    return i;
+}
+
+/*
+marks a node as 'in use' if it isn't already marked as such
+a freshly marked node is pushed to have its children marked later
+*/
+static void mark(ptr i)
+{
+    if (is_immediate(i))
+    {
+        return;
+    }
+    if (deque)
+    {
+        if (__atomic_load_n(&MARK(i), __ATOMIC_RELAXED) != gen &&
+            __atomic_exchange_n(&MARK(i), gen, __ATOMIC_RELAXED) != gen)
+        {
+            deque_push(deque, i);
+        }
+    }
+    else if (MARK(i) != gen)
+    {
+        MARK(i) = gen;
+        mark_stack = reserve(mark_stack, mark_stack_len, &mark_stack_cap, sizeof(ptr));
+        mark_stack[mark_stack_len++] = i;
+    }
+}
+
+/* marks the nodes referenced by a node */
+static void mark_children(ptr i)
+{
+    if (kind(i) == T_CON || kind(i) == T_ENV)
+    {
+        mark(NODE(i).head);
+        mark(NODE(i).tail);
+    }
+    else if (kind(i) == T_VEC)
+    {
+        for (i64 k = 0; k < NODE(i).items_len; k++)
+        {
+            mark(NODE(i).items[k]);
+        }
+    }
+    else if (kind(i) == T_MAP)
+    {
+        map_mark(NODE(i).map, mark);
+    }
+    else if (kind(i) == T_SYM && !symbols[NODE(i).symbol].interned)
+    {
+        // the binding of an uninterned symbol lives as long as the symbol
+        mark(symbols[NODE(i).symbol].binding);
+    }
+}
+
+/* marks everything reachable from the marked nodes */
+static void mark_reachable(void)
+{
+    while (mark_stack_len)
+    {
+        mark_children(mark_stack[--mark_stack_len]);
+    }
+}
+
+/* marks the values of all rooted variables and the environments of the threads */
+static void mark_roots(void)
+{
+    vm_mark_roots(mark);
+    eval_mark_roots(mark);
+    for (i64 t = 0; t < mutators_len; t++)
+    {
+        mutator_t *m = mutators[t];
+        mark(*m->env);
+        for (i64 k = 0; k < m->roots_len; k++)
+        {
+            mark(*m->roots[k]);
+        }
+    }
+}
+
+/* marks values with a global binding */
+static void mark_globals(void)
+{
+    for (i64 s = 0; s < symbols_len; s++)
+    {
+        if (symbols[s].interned)
+        {
+            mark(symbols[s].binding);
+        }
+    }
+}
+
+/*
+marks the young nodes that are reachable from the roots, the globals bound
+since the last collection and the remembered old nodes.
+old nodes are already marked and are not traversed,
+so this is proportional to the surviving young nodes.
+*/
+static void mark_young_reachable(void)
+{
+    mark_roots();
+    for (i64 k = 0; k < dirty_len; k++)
+    {
+        mark(symbols[dirty_symbols[k]].binding);
+    }
+    for (i64 k = 0; k < remembered_len; k++)
+    {
+        mark_children(remembered[k]);
+    }
+    mark_reachable();
+}
+
+/* called when an uninterned symbol is collected, by any of the sweeping threads */
+static void free_symbol(i64 k)
+{
+    free(symbols[k].name);
+    symbols[k].name = NULL;
+    symbols[k].binding = UNBOUND;
+    pthread_mutex_lock(&gc_lock);
+    free_symbols = reserve(free_symbols, free_symbols_len, &free_symbols_cap, sizeof(i64));
+    free_symbols[free_symbols_len++] = k;
+    pthread_mutex_unlock(&gc_lock);
+}
+
+/*
+frees the unmarked nodes of a block
+returns the number of nodes that are still in use
+*/
+static i64 sweep_block(i64 block)
+{
+    i64 begin = block * BLOCK_LEN;
+    i64 end = begin + BLOCK_LEN < high_water ? begin + BLOCK_LEN : high_water;
+    if (begin < builtin_use)
+    {
+        begin = builtin_use;
+    }
+    i64 freed_bytes = 0;
+    block_unswept[block] = false;
+    for (i64 k = begin; k < end; k++)
+    {
+        if (marks[k] == gen || kinds[k] == T_EMT)
+        {
+            continue;
+        }
+        if (kinds[k] == T_SYM)
+        {
+            if (symbols[mem[k].symbol].interned)
+            {
+                continue;
+            }
+            free_symbol(mem[k].symbol);
+        }
+        else if (kinds[k] == T_STR && !is_mapped(mem[k].bytes))
+        {
+            free(mem[k].bytes);
+            freed_bytes += mem[k].bytes_len + 1;
+        }
+        else if (kinds[k] == T_VEC)
+        {
+            free(mem[k].items);
+            freed_bytes += mem[k].items_len * (i64)sizeof(ptr);
+        }
+        else if (kinds[k] == T_MAP)
+        {
+            map_destroy(mem[k].map);
+        }
+        else if (kinds[k] == T_BIG)
+        {
+            big_destroy(mem[k].big);
+        }
+        kinds[k] = T_EMT;
+        block_used[block]--;
+    }
+    __atomic_sub_fetch(&large_bytes, freed_bytes, __ATOMIC_RELAXED);
+    return block_used[block];
+}
+
+/* whether a deque of a marking thread has nodes left */
+static int has_work(void)
+{
+    for (i64 t = 0; t < gc_threads; t++)
+    {
+        if (__atomic_load_n(&deques[t].top, __ATOMIC_SEQ_CST) <
+            __atomic_load_n(&deques[t].bottom, __ATOMIC_SEQ_CST))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+traces the nodes of the own deque, then steals from the others.
+marking is done once all threads are idle at the same time:
+a thread is only idle with an empty deque, and only the owner pushes to a deque.
+in a step of a cycle a thread stops after MARK_STEP_NODES nodes or at the deadline,
+the nodes left in the deques are marked by the next step
+*/
+static void trace(i64 id)
+{
+    i64 traced = 0;
+    while (true)
+    {
+        ptr i = deque_pop(deque);
+        for (i64 k = 1; i == new_nil() && k < gc_threads; k++)
+        {
+            i = deque_steal(&deques[(id + k) % gc_threads]);
+        }
+        if (i != new_nil())
+        {
+            mark_children(i);
+            traced++;
+            if (step_deadline && (traced >= MARK_STEP_NODES ||
+                                  (traced % 1024 == 0 && now_us() >= step_deadline)))
+            {
+                return;
+            }
+            continue;
+        }
+        __atomic_add_fetch(&idle_markers, 1, __ATOMIC_SEQ_CST);
+        while (!has_work())
+        {
+            if (__atomic_load_n(&idle_markers, __ATOMIC_SEQ_CST) == gc_threads ||
+                (step_deadline && now_us() >= step_deadline))
+            {
+                return;
+            }
+            sched_yield();
+        }
+        __atomic_sub_fetch(&idle_markers, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* the first thread marks the roots, all of them a share of the globals */
+static void mark_phase(i64 id)
+{
+    deque = &deques[id];
+    if (id == 0)
+    {
+        mark_roots();
+    }
+    for (i64 s = symbols_len * id / gc_threads; s < symbols_len * (id + 1) / gc_threads; s++)
+    {
+        if (symbols[s].interned)
+        {
+            mark(symbols[s].binding);
+        }
+    }
+    trace(id);
+    deque = NULL;
+}
+
+static void sweep_phase(i64 id)
+{
+    (void)id;
+    i64 blocks = heap_len / BLOCK_LEN;
+    while (true)
+    {
+        i64 begin = __atomic_fetch_add(&sweep_next, SWEEP_CHUNK, __ATOMIC_RELAXED);
+        if (begin >= blocks)
+        {
+            return;
+        }
+        for (i64 b = begin; b < begin + SWEEP_CHUNK && b < blocks; b++)
+        {
+            sweep_block(b);
+        }
+    }
+}
+
+/* a step of a cycle: each thread traces from a share of the mark stack */
+static void mark_step_phase(i64 id)
+{
+    deque = &deques[id];
+    for (i64 k = mark_stack_len * id / gc_threads; k < mark_stack_len * (id + 1) / gc_threads; k++)
+    {
+        deque_push(deque, mark_stack[k]);
+    }
+    trace(id);
+    deque = NULL;
+}
+
+/* a step of a cycle: the threads sweep the unswept blocks up to `step_sweep_end` */
+static void sweep_step_phase(i64 id)
+{
+    (void)id;
+    do
+    {
+        i64 begin = __atomic_fetch_add(&sweep_next, SWEEP_CHUNK, __ATOMIC_RELAXED);
+        if (begin >= step_sweep_end)
+        {
+            return;
+        }
+        for (i64 b = begin; b < begin + SWEEP_CHUNK && b < step_sweep_end; b++)
+        {
+            if (block_unswept[b])
+            {
+                sweep_block(b);
+            }
+        }
+    } while (now_us() < step_deadline);
+}
+
+static void *gc_helper(void *arg)
+{
+    i64 id = (i64)arg;
+    i64 seen = 0;
+    pthread_mutex_lock(&gc_lock);
+    while (true)
+    {
+        while (seen == phase_id)
+        {
+            pthread_cond_wait(&phase_cond, &gc_lock);
+        }
+        seen = phase_id;
+        if (id >= phase_threads)
+        {
+            continue;
+        }
+        pthread_mutex_unlock(&gc_lock);
+        phase(id);
+        pthread_mutex_lock(&gc_lock);
+        phase_done++;
+        pthread_cond_signal(&phase_done_cond);
+    }
+    return NULL;
+}
+
+/* runs a phase on `gc_threads` threads, the calling thread is the first of them */
+static void run_phase(void (*fn)(i64 id))
+{
+    while (gc_helpers_len < gc_threads - 1)
+    {
+        int err = pthread_create(&gc_helpers[gc_helpers_len], NULL, gc_helper,
+                                 (void *)(gc_helpers_len + 1));
+        assert(!err);
+        gc_helpers_len++;
+    }
+    pthread_mutex_lock(&gc_lock);
+    phase = fn;
+    phase_threads = gc_threads;
+    phase_done = 1;
+    phase_id++;
+    pthread_cond_broadcast(&phase_cond);
+    pthread_mutex_unlock(&gc_lock);
+
+    fn(0);
+
+    pthread_mutex_lock(&gc_lock);
+    while (phase_done < phase_threads)
+    {
+        pthread_cond_wait(&phase_done_cond, &gc_lock);
+    }
+    pthread_mutex_unlock(&gc_lock);
+}
+
+/* whether collections are large enough to be done by `gc_threads` threads */
+static int use_gc_threads(void)
+{
+    return gc_threads > 1 && heap_len >= PARALLEL_GC_MIN_LEN;
+}
+
+/* runs a phase that marks with the deques, the buffers they outgrew are freed after it */
+static void run_mark_phase(void (*fn)(i64 id))
+{
+    for (i64 t = 0; t < gc_threads; t++)
+    {
+        if (!deques[t].buf)
+        {
+            deques[t].buf = new_deque_buf(DEQUE_INIT_CAP);
+        }
+    }
+    idle_markers = 0;
+    run_phase(fn);
+    for (i64 t = 0; t < gc_threads; t++)
+    {
+        for (i64 k = 0; k < deques[t].old_len; k++)
+        {
+            free(deques[t].old[k]->items);
+            free(deques[t].old[k]);
+        }
+        deques[t].old_len = 0;
+    }
+}
+
+/* marks and sweeps the whole heap on `gc_threads` threads */
+static void parallel_gc(void)
+{
+    step_deadline = 0;
+    run_mark_phase(mark_phase);
+    sweep_next = 0;
+    run_phase(sweep_phase);
+}
+
+/* marks a part of a cycle on `gc_threads` threads, the nodes they left are pushed back */
+static void parallel_mark_step(i64 deadline)
+{
+    step_deadline = deadline;
+    run_mark_phase(mark_step_phase);
+    mark_stack_len = 0;
+    for (i64 t = 0; t < gc_threads; t++)
+    {
+        // nil is a node that can be on the stack, so a pop of nil does not mean it is empty
+        while (deques[t].top < deques[t].bottom)
+        {
+            mark_stack = reserve(mark_stack, mark_stack_len, &mark_stack_cap, sizeof(ptr));
+            mark_stack[mark_stack_len++] = deque_pop(&deques[t]);
+        }
+    }
+}
+
+/* sweeps up to SWEEP_STEP_BLOCKS blocks per thread of a cycle on `gc_threads` threads */
+static void parallel_sweep_step(i64 deadline)
+{
+    i64 blocks = high_water / BLOCK_LEN;
+    step_deadline = deadline;
+    step_sweep_end = sweep_cursor + SWEEP_STEP_BLOCKS * gc_threads;
+    step_sweep_end = step_sweep_end < blocks ? step_sweep_end : blocks;
+    sweep_next = sweep_cursor;
+    run_phase(sweep_step_phase);
+    sweep_cursor = sweep_next < step_sweep_end ? sweep_next : step_sweep_end;
+}
+
+i64 set_gc_threads(i64 threads)
+{
+    i64 previous = gc_threads;
+    gc_threads = threads < 1 ? 1 : threads < MAX_GC_THREADS ? threads : MAX_GC_THREADS;
+    return previous;
+}
+
+/*
+after a collection all nodes are old,
+the rest of the blocks of the threads is the start of the next nursery
+*/
+static void reset_young(void)
+{
+    young_len = 0;
+    for (i64 t = 0; t < mutators_len; t++)
+    {
+        mutator_t *m = mutators[t];
+        if (m->alloc_cursor < m->alloc_limit)
+        {
+            young_blocks[young_len++] = m->alloc_cursor / BLOCK_LEN;
+        }
+    }
+    remembered_len = 0;
+    dirty_len = 0;
+    large_bytes_after_gc = large_bytes;
+}
+
+/*
+minor collection: only young nodes are traced and
+only the blocks that were allocated into are swept
+*/
+static void minor_gc(void)
+{
+    i64 begin = now_us();
+    minor_gcs++;
+    mark_young_reachable();
+    for (i64 k = 0; k < young_len; k++)
+    {
+        sweep_block(young_blocks[k]);
+    }
+    vm_sweep();
+    eval_sweep();
+    reset_young();
+
+    // the pause is about proportional to the nursery, which is halved while the
+    // pauses are over the budget, and doubled back while they are well below it
+    i64 pause = now_us() - begin;
+    if (!pause_budget)
+    {
+        return;
+    }
+    if (pause > pause_budget && nursery_len > NURSERY_MIN_LEN)
+    {
+        nursery_len /= 2;
+    }
+    else if (4 * pause < pause_budget && nursery_len < NURSERY_LEN)
+    {
+        nursery_len *= 2;
+    }
+}
+
+/* grows or shrinks the heap after a full collection, so it is about half full */
+static void adapt_heap(void)
+{
+    used_after_full = count_used();
+    int usage = (int)(100 * used_after_full / heap_len);
+    // printf("GC go brrrr... (%d%% of %ld)\n", usage, heap_len);
+    if (usage > MAX_MEMORY_USAGE)
+    {
+        grow();
+    }
+    else if (usage < MAX_MEMORY_USAGE / 4)
+    {
+        shrink();
+    }
+}
+
+/* starts an incremental cycle: all nodes turn white, the roots and the globals gray */
+static void start_cycle(void)
+{
+    gen = 3 - gen;
+    alloc_mark = gen;
+    cycle = GC_MARKING;
+    mark_globals();
+    mark_roots();
+    // the nodes that survive the cycle are old, no node has to be remembered for it
+    young_len = 0;
+    remembered_len = 0;
+    dirty_len = 0;
+}
+
+/*
+all reachable nodes are marked: the blocks are left to be swept.
+the blocks the threads allocate into are swept right away,
+as the nodes allocated into them from now on are young
+*/
+static void finish_marking(void)
+{
+    full_gcs++;
+    cycle = GC_SWEEPING;
+    alloc_mark = 0;
+    for (i64 b = 0; b < high_water / BLOCK_LEN; b++)
+    {
+        block_unswept[b] = true;
+    }
+    for (i64 t = 0; t < mutators_len; t++)
+    {
+        mutator_t *m = mutators[t];
+        if (m->alloc_cursor < m->alloc_limit)
+        {
+            sweep_block(m->alloc_cursor / BLOCK_LEN);
+        }
+    }
+    sweep_cursor = 0;
+    vm_sweep();
+    eval_sweep();
+    reset_young();
+}
+
+static void finish_sweeping(void)
+{
+    cycle = GC_IDLE;
+    adapt_heap();
+}
+
+/*
+marks until the mark stack is empty, MARK_STEP_NODES are marked or the budget is spent.
+the clock is read once per batch of nodes, at least one batch is marked.
+a large heap is marked by `gc_threads` threads, each with these limits
+*/
+static void mark_step(void)
+{
+    i64 deadline = now_us() + pause_budget;
+    if (use_gc_threads())
+    {
+        parallel_mark_step(deadline);
+    }
+    else
+    {
+        i64 marked = 0;
+        do
+        {
+            for (i64 k = 0; k < 1024 && mark_stack_len && marked < MARK_STEP_NODES; k++)
+            {
+                mark_children(mark_stack[--mark_stack_len]);
+                marked++;
+            }
+        } while (mark_stack_len && marked < MARK_STEP_NODES && now_us() < deadline);
+    }
+    if (!mark_stack_len)
     {
-        mem[i].kind = T_EMT;
-        if (i < MEM_LEN - 1)
+        // the roots have no barrier, marking is done once none of them is white
+        mark_roots();
+        if (!mark_stack_len)
         {
-            mem[i].next_free = i + 1;
+            finish_marking();
         }
-        else
+    }
+}
+
+static void sweep_step(void)
+{
+    i64 deadline = now_us() + pause_budget;
+    i64 blocks = high_water / BLOCK_LEN;
+    if (use_gc_threads())
+    {
+        parallel_sweep_step(deadline);
+    }
+    else
+    {
+        for (i64 k = 0; k < SWEEP_STEP_BLOCKS && sweep_cursor < blocks && (!k || now_us() < deadline); k++)
         {
-            mem[i].next_free = i;
+            if (block_unswept[sweep_cursor])
+            {
+                sweep_block(sweep_cursor);
+            }
+            sweep_cursor++;
         }
     }
-
-    init_builtin_symbols();
-    register_builtins();
-    builtin_use = empty;
-    read_input();
-    initialized = MEM_INITIALIZED;
+    if (sweep_cursor >= blocks)
+    {
+        finish_sweeping();
+    }
 }
 
-/* GC run count */
-static int gen = 1;
+/* does a part of the cycle, when a thread takes a new block */
+static void cycle_step(void)
+{
+    if (cycle == GC_MARKING)
+    {
+        mark_step();
+    }
+    else if (cycle == GC_SWEEPING)
+    {
+        sweep_step();
+    }
+}
 
-/* marks values with a global binding as 'in use' */
-static void mark_globals(void)
+/* finishes the cycle that is running without pauses */
+static void finish_cycle(void)
 {
-    for (ptr s = 0; s < SYM_LEN; s++)
+    if (cycle == GC_MARKING)
+    {
+        mark_reachable();
+        mark_roots();
+        mark_reachable();
+        finish_marking();
+    }
+    if (cycle == GC_SWEEPING)
     {
-        if (symbols[s].name[0] != 0)
+        for (i64 b = 0; b < high_water / BLOCK_LEN; b++)
         {
-            int binding = symbols[s].binding;
-            mem[binding].gc = gen;
+            if (block_unswept[b])
+            {
+                sweep_block(b);
+            }
         }
+        finish_sweeping();
     }
 }
 
-ptr *walker;
-
 /*
-searches the entire C stack for references to LISP values
-if it finds any, it marks those values as 'in use'
+garbage collector to free up nodes, in one pause.
+a cycle that is running is finished first.
+does not return if out of memory, instead will stop program
 */
-void stack_search_impl(void)
+void gc(void)
 {
-    ptr stack_bottom = 0;
-    walker = &stack_bottom;
-    while (++walker != stack_top)
+    finish_cycle();
+    full_gcs++;
+    gen = 3 - gen;
+    if (use_gc_threads())
+    {
+        parallel_gc();
+    }
+    else
     {
-        if (*walker<MEM_LEN && * walker> 0)
+        mark_globals();
+        mark_roots();
+        mark_reachable();
+        for (i64 b = 0; b < heap_len / BLOCK_LEN; b++)
         {
-            mem[*walker].gc = gen;
+            sweep_block(b);
         }
     }
+    vm_sweep();
+    eval_sweep();
+    adapt_heap();
+    reset_young();
 }
 
-static void mark_reachable(ptr i);
-
 /*
-marks a value as 'in use' if it isn't already marked as such
-if it is a freshly marked value, it will also mark the child values
+collects the young generation, and starts collecting the old one as well
+if it has grown a lot since the last full collection.
+while a cycle marks there is no young generation, a part of the marking is done instead
 */
-static void maybe_mark(ptr i)
+static void collect(void)
 {
-    if (mem[i].gc != gen)
+    if (cycle == GC_MARKING)
     {
-        mem[i].gc = gen;
-        mark_reachable(i);
+        mark_step();
+        return;
     }
-}
-
-/* marks descendants of the node as reachable */
-static void mark_reachable(ptr i)
-{
-    if (mem[i].gc != gen)
+    minor_gc();
+    if (cycle != GC_IDLE)
     {
         return;
     }
-    if (kind(i) == T_CON)
+    i64 used = count_used();
+    i64 full_threshold = 2 * used_after_full > heap_len / 8 ? 2 * used_after_full : heap_len / 8;
+    if (used > full_threshold || 100 * used / heap_len > MAX_MEMORY_USAGE)
     {
-        maybe_mark(get_head(i));
-        maybe_mark(get_tail(i));
+        if (pause_budget)
+        {
+            start_cycle();
+        }
+        else
+        {
+            gc();
+        }
     }
 }
 
-/* marks all indirectly reachable nodes as used */
-static void mark_all_reachable(void)
+i64 set_pause_budget(i64 budget)
+{
+    i64 previous = pause_budget;
+    pause_budget = budget > 0 ? budget : 0;
+    nursery_len = NURSERY_LEN;
+    return previous;
+}
+
+static int compare_pauses(const void *a, const void *b)
+{
+    i64 x = *(const i64 *)a;
+    i64 y = *(const i64 *)b;
+    return (x > y) - (x < y);
+}
+
+ptr pause_stats(void)
 {
-    for (ptr i = 0; i < MEM_LEN; i++)
+    lock_shared();
+    i64 total = 0;
+    for (i64 k = 0; k < pauses_len; k++)
     {
-        mark_reachable(i);
+        total += pauses[k];
     }
+    qsort(pauses, (size_t)pauses_len, sizeof(i64), compare_pauses);
+    i64 count = pauses_len;
+    i64 max = count ? pauses[count - 1] : 0;
+    i64 p99 = count ? pauses[(count * 99 - 1) / 100] : 0;
+    pauses_len = 0;
+    unlock_shared();
+    return new_list(4, new_int(count), new_int(max), new_int(p99), new_int(total));
+}
+
+/* collects all garbage now, returns how long the program was paused in microseconds */
+i64 full_gc(void)
+{
+    i64 begin = now_us();
+    lock_shared();
+    safepoint();
+    stop_the_world(gc);
+    unlock_shared();
+    return now_us() - begin;
 }
 
 /*
-marks all unreachable nodes as 'empty' and make them available to be reused
+gives the thread a block with free nodes that no other thread allocates into.
+blocks that were not swept yet are swept first if `sweep` is set,
+otherwise they are skipped. returns false if there is no such block
 */
-static void reconstruct_empty_list(void)
+static int take_block(mutator_t *m, int sweep)
 {
-    ptr prev_empty = 0;
-    int free_memory = 0;
-    for (ptr i = builtin_use; i < MEM_LEN; i++)
+    i64 blocks = heap_len / BLOCK_LEN;
+    i64 block = m->alloc_cursor / BLOCK_LEN;
+    for (i64 k = 0; k < blocks; k++)
     {
-        if (mem[i].gc == gen || kind(i) == T_SYM)
+        block = (block + 1) % blocks;
+        // only the owner of a block counts its nodes without the lock
+        if (block_owned[block] || (block_unswept[block] && !sweep))
         {
             continue;
         }
-        mem[i].kind = T_EMT;
-        mem[i].gc = ~0;
-        free_memory++;
-        if (prev_empty)
+        if (block_unswept[block])
         {
-            mem[i].next_free = prev_empty;
+            sweep_block(block);
         }
-        else
+        if (block_used[block] < BLOCK_LEN)
         {
-            mem[i].next_free = i;
+            if (block * BLOCK_LEN >= high_water)
+            {
+                // never used blocks are allocated in order from the high water mark
+                block = high_water / BLOCK_LEN;
+                memset(&kinds[high_water], T_EMT, BLOCK_LEN);
+                high_water += BLOCK_LEN;
+            }
+            block_owned[block] = true;
+            // the nodes allocated while a cycle marks are not young
+            if (cycle != GC_MARKING)
+            {
+                young_blocks[young_len++] = block;
+            }
+            m->alloc_cursor = block * BLOCK_LEN;
+            m->alloc_limit = m->alloc_cursor + BLOCK_LEN;
+            return true;
         }
-        prev_empty = i;
-    }
-    empty = prev_empty;
-
-    int usage = 100 - 100 * free_memory / MEM_LEN;
-    // printf("GC go brrrr... (%d%%)\n", usage);
-    if (usage > MAX_MEMORY_USAGE || usage > 99)
-    {
-        printf("Out of memory.\n");
-        exit(-1);
     }
+    return false;
 }
 
 /*
-garbage collector to free up nodes
-does not return if out of memory, instead will stop program
+moves the allocation cursor of the thread to the next block.
+a running cycle does a step each time.
+the nursery is full after allocating into `nursery_len` nodes worth of blocks
+(or half the heap if that is smaller), then the garbage is collected.
+if no block has free nodes, the heap grows while a cycle marks,
+otherwise all garbage is collected, and then the heap grows.
 */
-void gc(void)
+static void next_block(void)
 {
-    gen = (gen + 1) & ((~0) >> 1);
-    mark_globals();
-    stack_search();
-    mark_all_reachable();
-    reconstruct_empty_list();
+    mutator_t *m = self;
+    lock_shared();
+    safepoint();
+    release_block(m);
+    if (cycle != GC_IDLE)
+    {
+        stop_the_world(cycle_step);
+    }
+    i64 nursery = nursery_len < heap_len / 2 ? nursery_len : heap_len / 2;
+    if (young_len * BLOCK_LEN >= nursery)
+    {
+        stop_the_world(collect);
+    }
+    int found = take_block(m, false) || take_block(m, true);
+    if (!found)
+    {
+        if (cycle == GC_MARKING && heap_len + HEAP_CHUNK_LEN <= MEM_LEN)
+        {
+            // what is garbage is only known once marking is done
+            grow();
+        }
+        else
+        {
+            stop_the_world(gc);
+        }
+        found = take_block(m, true);
+    }
+    if (!found)
+    {
+        grow();
+        found = take_block(m, true);
+    }
+    if (!found)
+    {
+        printf("Out of memory.\n");
+        exit(-1);
+    }
+    unlock_shared();
 }
 
 static ptr alloc(void)
 {
-    if (kind(empty) != T_EMT)
+    mutator_t *m = self;
+    while (m->alloc_cursor == m->alloc_limit || kinds[m->alloc_cursor] != T_EMT)
     {
-        gc();
+        if (m->alloc_cursor == m->alloc_limit)
+        {
+            next_block();
+        }
+        else
+        {
+            m->alloc_cursor++;
+        }
     }
-
-    ptr next = mem[empty].next_free;
-    ptr new = empty;
-    empty = next;
+    i64 new = m->alloc_cursor++;
+    block_used[new / BLOCK_LEN]++;
+    m->allocated++;
 
     node_t zero = {0};
     mem[new] = zero;
-    mem[new].gc = gen;
+    marks[new] = alloc_mark;
 
-    return new;
+    return node_ref(new);
 }
 
 static void check(ptr i)
 {
-    if (i >= 0 && i < MEM_LEN)
+    if (!is_immediate(i) && i >= 0 && node_index(i) < heap_len)
     {
-        if (mem[i].gc == ~0 && mem[i].kind == T_EMT)
+        if (KIND(i) == T_EMT)
         {
             printf("%ld ", i);
             println(i);
@@ -299,20 +1764,30 @@ static void check(ptr i)
 
 ptr new_int(i64 value)
 {
+    if (value >= FIXNUM_MIN && value <= FIXNUM_MAX)
+    {
+        return (ptr)((uint64_t)value << 1) | 1;
+    }
     ptr i = alloc();
-    mem[i].kind = T_INT;
-    mem[i].value = value;
+    KIND(i) = T_INT;
+    NODE(i).value = value;
     return i;
 }
 
 ptr new_cons(ptr head, ptr tail)
 {
+    i64 scope = scope_begin();
+    root(&head);
+    root(&tail);
     ptr i = alloc();
-    mem[i].kind = T_CON;
+    scope_end(scope);
+    KIND(i) = T_CON;
     check(head);
     check(tail);
-    mem[i].head = head;
-    mem[i].tail = tail;
+    NODE(i).head = head;
+    NODE(i).tail = tail;
+    shade(head);
+    shade(tail);
     return i;
 }
 
@@ -326,26 +1801,31 @@ ptr new_list(int len, ...)
     va_list vargs;
     va_start(vargs, len);
 
+    i64 scope = scope_begin();
     ptr args[len];
 
     for (int i = 0; i < len; i++)
     {
         args[i] = va_arg(vargs, ptr);
+        root(&args[i]);
     }
+    va_end(vargs);
 
     ptr list = new_nil();
+    root(&list);
 
     for (int i = len - 1; i >= 0; i--)
     {
         list = new_cons(args[i], list);
     }
 
+    scope_end(scope);
     return list;
 }
 
 ptr new_true(void)
 {
-    return 1;
+    return new_int(1);
 }
 
 ptr quoted(ptr i)
@@ -355,7 +1835,13 @@ ptr quoted(ptr i)
     {
     case T_CON:
     case T_SYM:
-        return new_list(2, new_symbol("quote"), i);
+    {
+        i64 scope = scope_begin();
+        root(&i);
+        ptr list = new_list(2, sym_quote, i);
+        scope_end(scope);
+        return list;
+    }
     default:
         return i;
     }
@@ -363,110 +1849,419 @@ ptr quoted(ptr i)
 
 ptr new_builtin(ptr (*fun)(ptr), char *sym, int kind)
 {
+    i64 scope = scope_begin();
     ptr i = alloc();
-    assert(kind == T_FUN || kind == T_MAC);
-    mem[i].kind = kind;
-    mem[i].builtin = fun;
+    root(&i);
+    assert(kind == T_FUN || kind == T_MAC || kind == T_SPC);
+    KIND(i) = kind;
+    NODE(i).builtin = fun;
     ptr s = new_symbol(sym);
     new_binding(s, i);
+    scope_end(scope);
     return i;
 }
 
-ptr new_symbol(char *symbol)
+ptr new_env(ptr formal_args, ptr values, ptr parent)
 {
-    if (!strcmp(symbol, "nil") || !strcmp(symbol, "NIL"))
+    i64 scope = scope_begin();
+    root(&parent);
+    ptr frame = new_cons(formal_args, values);
+    root(&frame);
+    ptr i = alloc();
+    scope_end(scope);
+    KIND(i) = T_ENV;
+    check(parent);
+    NODE(i).frame = frame;
+    NODE(i).parent = parent;
+    shade(parent);
+    return i;
+}
+
+/* FNV-1a hash of a symbol name */
+static uint64_t hash_name(char *name)
+{
+    uint64_t hash = 14695981039346656037u;
+    for (; *name; name++)
     {
-        return 0;
+        hash ^= (uint8_t)*name;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+/* slot of the hash index that holds the symbol, or where it is to be inserted */
+static i64 find_slot(char *name, uint64_t hash)
+{
+    i64 mask = symbol_index_len - 1;
+    i64 slot = (i64)hash & mask;
+    while (symbol_index[slot])
+    {
+        sym_t *sym = &symbols[symbol_index[slot] - 1];
+        if (sym->hash == hash && !strcmp(sym->name, name))
+        {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* the interned symbol with the name, or nil */
+static ptr find_symbol(char *name, uint64_t hash)
+{
+    if (!symbol_index_len)
+    {
+        return new_nil();
     }
+    i64 slot = find_slot(name, hash);
+    return symbol_index[slot] ? symbols[symbol_index[slot] - 1].node : new_nil();
+}
 
-    for (ptr k = 0; k < SYM_LEN; k++)
+/* doubles the hash index, or creates it */
+static void grow_symbol_index(void)
+{
+    free(symbol_index);
+    symbol_index_len = symbol_index_len ? 2 * symbol_index_len : 1024;
+    symbol_index = calloc((size_t)symbol_index_len, sizeof(i64));
+    assert(symbol_index);
+    for (i64 k = 0; k < symbols_len; k++)
     {
-        if (strlen(symbols[k].name) == 0)
+        if (symbols[k].interned)
         {
-            // we arrived at the section of unused symbols
-            // we have not found the symbol in the existing table
-            // we add a new symbol
+            symbol_index[find_slot(symbols[k].name, symbols[k].hash)] = k + 1;
+        }
+    }
+}
+
+/* copies the name of a new interned symbol to the arena */
+static char *intern_name(char *name)
+{
+    i64 size = (i64)strlen(name) + 1;
+    if (names_len + size > names_cap)
+    {
+        names_cap = size > SYM_NAMES_CHUNK ? size : SYM_NAMES_CHUNK;
+        names = malloc((size_t)names_cap);
+        assert(names);
+        names_len = 0;
+        names_size += names_cap;
+    }
+    char *copy = &names[names_len];
+    memcpy(copy, name, (size_t)size);
+    names_len += size;
+    return copy;
+}
 
-            ptr i = alloc();
-            mem[i].kind = T_SYM;
-            mem[i].symbol = k;
+/* adds an unbound symbol to the table as the new node `i`, with the lock held */
+static ptr add_symbol(ptr i, char *name, uint64_t hash, int interned)
+{
+    i64 k;
+    if (free_symbols_len)
+    {
+        k = free_symbols[--free_symbols_len];
+    }
+    else
+    {
+        if (symbols_len == symbols_cap)
+        {
+            i64 cap = symbols_cap ? 2 * symbols_cap : 1024;
+            cap = cap < MEM_LEN ? cap : MEM_LEN;
+            commit(symbols, sizeof(sym_t), symbols_cap, cap);
+            symbols_cap = cap;
+        }
+        k = symbols_len++;
+    }
 
-            int len = (int)strlen(symbol);
-            assert(len > 0 && len < 16);
+    KIND(i) = T_SYM;
+    NODE(i).symbol = k;
 
-            strcpy(symbols[k].name, symbol);
+    symbols[k].binding = UNBOUND; // point to garbage
+    symbols[k].node = i;
+    symbols[k].hash = hash;
+    symbols[k].name = name;
+    symbols[k].interned = interned;
+    return i;
+}
 
-            symbols[k].binding = UNBOUND; // point to garbage
-            symbols[k].node = i;
-            return i;
+/*
+allocates memory in the large object space.
+the garbage is collected when enough of it was allocated since the last collection,
+the caller has to hand the memory to a node before allocating anything else
+*/
+void *alloc_large(size_t size)
+{
+    lock_shared();
+    i64 threshold = large_bytes_after_gc > LARGE_NURSERY_BYTES ? large_bytes_after_gc
+                                                               : LARGE_NURSERY_BYTES;
+    // stopping would let other threads in while the caller holds the lock
+    if (shared_depth <= 1)
+    {
+        safepoint();
+        if (__atomic_load_n(&large_bytes, __ATOMIC_RELAXED) - large_bytes_after_gc > threshold)
+        {
+            stop_the_world(collect);
         }
-        else if (!strcmp(symbols[k].name, symbol))
+    }
+    __atomic_add_fetch(&large_bytes, (i64)size, __ATOMIC_RELAXED);
+    unlock_shared();
+    void *memory = malloc(size ? size : 1);
+    assert(memory);
+    return memory;
+}
+
+void free_large(void *memory, size_t size)
+{
+    free(memory);
+    __atomic_sub_fetch(&large_bytes, (i64)size, __ATOMIC_RELAXED);
+}
+
+/*
+returns a string of a copy of `bytes`.
+bytes of a mapped file are not copied, the string points into the file
+*/
+ptr new_string(char *bytes, i64 len)
+{
+    if (is_mapped(bytes))
+    {
+        ptr i = alloc();
+        KIND(i) = T_STR;
+        NODE(i).bytes = bytes;
+        NODE(i).bytes_len = len;
+        return i;
+    }
+
+    char *copy = alloc_large((size_t)len + 1);
+    memcpy(copy, bytes, (size_t)len);
+    copy[len] = 0;
+    ptr i = alloc();
+    KIND(i) = T_STR;
+    NODE(i).bytes = copy;
+    NODE(i).bytes_len = len;
+    return i;
+}
+
+ptr new_map(void)
+{
+    map_t *m = map_create();
+    ptr i = alloc();
+    KIND(i) = T_MAP;
+    NODE(i).map = m;
+    return i;
+}
+
+/* returns a bignum node that owns `b` */
+ptr new_big(big_t *b)
+{
+    ptr i = alloc();
+    KIND(i) = T_BIG;
+    NODE(i).big = b;
+    return i;
+}
+
+/* returns a vector of `len` elements that are all `init` */
+ptr new_vector(i64 len, ptr init)
+{
+    assert(len >= 0);
+    i64 scope = scope_begin();
+    root(&init);
+    ptr *items = alloc_large((size_t)len * sizeof(ptr));
+    for (i64 k = 0; k < len; k++)
+    {
+        items[k] = init;
+    }
+    ptr i = alloc();
+    KIND(i) = T_VEC;
+    NODE(i).items = items;
+    NODE(i).items_len = len;
+    shade(init);
+    scope_end(scope);
+    return i;
+}
+
+ptr new_symbol(char *symbol)
+{
+    if (!strcmp(symbol, "nil") || !strcmp(symbol, "NIL"))
+    {
+        return 0;
+    }
+    assert(strlen(symbol) > 0);
+
+    uint64_t hash = hash_name(symbol);
+    lock_shared();
+    ptr i = find_symbol(symbol, hash);
+    unlock_shared();
+    if (i)
+    {
+        return i;
+    }
+
+    // we have not found the symbol in the existing table, we add a new symbol.
+    // allocating can stop the thread for a collection, so it does not hold the lock
+    ptr node = alloc();
+    lock_shared();
+    i = find_symbol(symbol, hash);
+    if (i)
+    {
+        // another thread added it in the meantime, the node is garbage
+        KIND(node) = T_INT;
+    }
+    else
+    {
+        if (2 * (interned_len + 1) > symbol_index_len)
         {
-            return symbols[k].node;
+            grow_symbol_index();
         }
+        i = add_symbol(node, intern_name(symbol), hash, true);
+        symbol_index[find_slot(symbol, hash)] = get_symbol(i) + 1;
+        interned_len++;
     }
+    unlock_shared();
+    return i;
+}
 
-    failwith("Out of Symbols.");
+ptr new_uninterned_symbol(char *name)
+{
+    char *copy = malloc(strlen(name) + 1);
+    assert(copy);
+    strcpy(copy, name);
+    ptr node = alloc();
+    lock_shared();
+    ptr i = add_symbol(node, copy, hash_name(name), false);
+    unlock_shared();
+    return i;
 }
 
 i64 kind(ptr i)
 {
+    if (is_immediate(i))
+    {
+        return T_INT;
+    }
     assert(i >= 0);
-    assert(i < MEM_LEN);
-    return mem[i].kind;
+    assert(node_index(i) < heap_len);
+    return KIND(i);
 }
 
 i64 get_int(ptr i)
 {
+    if (is_immediate(i))
+    {
+        return i >> 1;
+    }
     check(i);
-    assert(mem[i].kind == T_INT);
-    return mem[i].value;
+    assert(kind(i) == T_INT);
+    return NODE(i).value;
 }
 
 ptr (*get_fn_ptr(ptr i))(ptr)
 {
-    assert(kind(i) == T_FUN || kind(i) == T_MAC);
-    return mem[i].builtin;
+    assert(kind(i) == T_FUN || kind(i) == T_MAC || kind(i) == T_SPC);
+    return NODE(i).builtin;
 }
 
 ptr get_head(ptr i)
 {
     check(i);
-    assert(mem[i].kind == T_CON);
-    return mem[i].head;
+    assert(kind(i) == T_CON);
+    return NODE(i).head;
 }
 
 ptr get_tail(ptr i)
 {
     check(i);
-    assert(mem[i].kind == T_CON);
-    return mem[i].tail;
+    assert(kind(i) == T_CON);
+    return NODE(i).tail;
 }
 
-ptr elem(int idx, ptr node)
+ptr get_frame(ptr i)
 {
-    check(node);
-    if (idx)
+    check(i);
+    assert(kind(i) == T_ENV);
+    return NODE(i).frame;
+}
+
+ptr get_parent(ptr i)
+{
+    check(i);
+    assert(kind(i) == T_ENV);
+    return NODE(i).parent;
+}
+
+char *get_string(ptr i)
+{
+    check(i);
+    assert(kind(i) == T_STR);
+    return NODE(i).bytes;
+}
+
+i64 get_string_len(ptr i)
+{
+    check(i);
+    assert(kind(i) == T_STR);
+    return NODE(i).bytes_len;
+}
+
+ptr get_vector_item(ptr i, i64 idx)
+{
+    check(i);
+    assert(kind(i) == T_VEC);
+    assert(idx >= 0 && idx < NODE(i).items_len && "vector index out of range");
+    return NODE(i).items[idx];
+}
+
+void set_vector_item(ptr i, i64 idx, ptr value)
+{
+    check(i);
+    assert(kind(i) == T_VEC);
+    assert(idx >= 0 && idx < NODE(i).items_len && "vector index out of range");
+    NODE(i).items[idx] = value;
+    if (!is_immediate(value))
     {
-        return elem(idx - 1, get_tail(node));
+        write_barrier(i, value);
     }
-    else
+}
+
+i64 get_vector_len(ptr i)
+{
+    check(i);
+    assert(kind(i) == T_VEC);
+    return NODE(i).items_len;
+}
+
+map_t *get_map(ptr i)
+{
+    check(i);
+    assert(kind(i) == T_MAP);
+    return NODE(i).map;
+}
+
+big_t *get_big(ptr i)
+{
+    check(i);
+    assert(kind(i) == T_BIG);
+    return NODE(i).big;
+}
+
+ptr elem(int idx, ptr node)
+{
+    check(node);
+    for (; idx; idx--)
     {
-        return get_head(node);
+        node = get_tail(node);
     }
+    return get_head(node);
 }
 
 ptr get_symbol(ptr i)
 {
     check(i);
-    assert(mem[i].kind == T_SYM);
-    return mem[i].symbol;
+    assert(kind(i) == T_SYM);
+    return NODE(i).symbol;
 }
 
 ptr get_nil(ptr i)
 {
     check(i);
-    assert(mem[i].kind == T_NIL);
+    assert(kind(i) == T_NIL);
     return 0;
 }
 
@@ -479,9 +2274,59 @@ void new_binding(ptr symbol, ptr expression)
         assert(initialized == MEM_INITIALIZING);
     }
     sym->binding = expression;
+    shade(expression);
+    profile_name(symbol, expression);
+    lock_shared();
+    dirty_symbols = reserve(dirty_symbols, dirty_len, &dirty_cap, sizeof(ptr));
+    dirty_symbols[dirty_len++] = get_symbol(symbol);
+    unlock_shared();
+}
+
+i64 mem_usage(void)
+{
+    return heap_len * (sizeof(node_t) + 2) + symbols_cap * (i64)sizeof(sym_t) +
+           symbol_index_len * (i64)sizeof(i64) + names_size + large_bytes;
+}
+
+void print_mem_stats(void)
+{
+    lock_shared();
+    i64 allocated = detached_allocated;
+    for (i64 t = 0; t < mutators_len; t++)
+    {
+        allocated += mutators[t]->allocated;
+    }
+    unlock_shared();
+    fprintf(stderr, "allocated=%ld minor_gcs=%ld full_gcs=%ld gc_us=%ld peak_heap_bytes=%ld\n",
+            allocated, minor_gcs, full_gcs, paused_us,
+            peak_heap_len * (i64)(sizeof(node_t) + 2));
+}
+
+i64 thread_allocated(void)
+{
+    return self->allocated;
+}
+
+i64 symbol_count(void)
+{
+    return symbols_len;
+}
+
+i64 heap_size(void)
+{
+    return heap_len;
 }
 
-int mem_usage(void)
+int is_live(ptr i)
 {
-    return sizeof(mem) + sizeof(symbols);
+    if (is_immediate(i) || i == new_nil())
+    {
+        return true;
+    }
+    if (node_index(i) >= heap_len || KIND(i) == T_EMT || KIND(i) == T_POO)
+    {
+        return false;
+    }
+    // the unmarked nodes of a block that was not swept yet are garbage
+    return !block_unswept[node_index(i) / BLOCK_LEN] || MARK(i) == gen;
 }
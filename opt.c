@@ -0,0 +1,659 @@
+#include "lisp.h"
+#include "assert.h"
+
+/*
+optimization pass over the body of a function when it is defined,
+and over macro expansions before they are cached.
+definitions can not be shadowed, so a symbol that is not bound locally
+and has a global binding already will refer to that binding forever. this allows to
+- fold calls of pure builtins whose arguments are constants,
+- inline calls of small functions whose body only calls other functions,
+- drop the clauses of `cond` whose condition is constant.
+forms whose meaning is not known are left alone: calls of macros, of locals
+and of functions that are not bound yet, as well as everything that is quoted.
+forms that do not change are returned as they are, not copied.
+*/
+
+// kinds of arguments a pure builtin is folded for
+#define ARGS_INT 0
+#define ARGS_ANY 1
+#define ARGS_LIST 2
+
+typedef struct
+{
+    char *name;
+    int args;
+    // number of arguments, -1 for any number
+    i64 min_len;
+    i64 max_len;
+    ptr fun;
+} pure_t;
+
+static pure_t pure[] = {
+    {"+", ARGS_INT, 0, -1, 0},
+    {"*", ARGS_INT, 0, -1, 0},
+    {"-", ARGS_INT, 1, 2, 0},
+    {"<", ARGS_INT, 0, -1, 0},
+    {">", ARGS_INT, 0, -1, 0},
+    {"<=", ARGS_INT, 0, -1, 0},
+    {">=", ARGS_INT, 0, -1, 0},
+    {"=", ARGS_ANY, 2, 2, 0},
+    {"hd", ARGS_LIST, 1, 1, 0},
+    {"tl", ARGS_LIST, 1, 1, 0},
+};
+#define PURE_LEN ((i64)(sizeof(pure) / sizeof(pure[0])))
+
+static ptr sym_cond = 0;
+static ptr sym_progn = 0;
+
+// symbol of the function that is being defined, calls of it are calls of a lambda
+static _Thread_local ptr defining = 0;
+
+static void init_optimizer(void)
+{
+    if (sym_cond)
+    {
+        return;
+    }
+    sym_cond = new_symbol("cond");
+    sym_progn = new_symbol("progn");
+    for (i64 k = 0; k < PURE_LEN; k++)
+    {
+        pure[k].fun = get_symbol_binding(get_symbol(new_symbol(pure[k].name)));
+    }
+}
+
+static i64 list_len(ptr i)
+{
+    i64 len = 0;
+    for (; kind(i) == T_CON; i = get_tail(i))
+    {
+        len++;
+    }
+    return len;
+}
+
+static int is_member(ptr symbol, ptr list)
+{
+    for (; kind(list) == T_CON; list = get_tail(list))
+    {
+        if (get_head(list) == symbol)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* `bound` is a list of the formal arguments of the enclosing functions */
+static int is_local(ptr symbol, ptr bound)
+{
+    for (; kind(bound) == T_CON; bound = get_tail(bound))
+    {
+        if (is_member(symbol, get_head(bound)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* whether `symbol` refers to a global binding, which is stored in `value` */
+static int global_binding(ptr symbol, ptr bound, ptr *value)
+{
+    if (kind(symbol) != T_SYM || is_local(symbol, bound))
+    {
+        return false;
+    }
+    *value = get_symbol_binding(get_symbol(symbol));
+    return kind(*value) != T_POO;
+}
+
+static int is_quote_form(ptr i)
+{
+    return kind(i) == T_CON && is_quote(get_head(i)) && kind(get_tail(i)) == T_CON;
+}
+
+static int is_function(ptr fun)
+{
+    return kind(fun) == T_FUN || (kind(fun) == T_CON && is_lambda(get_head(fun)));
+}
+
+/* lambdas that do not close over an environment */
+static int is_global_lambda(ptr fun)
+{
+    return kind(fun) == T_CON && is_lambda(get_head(fun)) && list_len(fun) == 3;
+}
+
+/* whether `i` always evaluates to the same value, which is stored in `value` */
+static int constant_value(ptr i, ptr bound, ptr *value)
+{
+    switch (kind(i))
+    {
+    case T_NIL:
+    case T_INT:
+    case T_BIG:
+    case T_STR:
+        *value = i;
+        return true;
+    case T_SYM:
+        return global_binding(i, bound, value) &&
+               (kind(*value) == T_NIL || kind(*value) == T_INT || kind(*value) == T_BIG);
+    case T_CON:
+        if (is_quote_form(i))
+        {
+            *value = elem(1, i);
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+/* arguments that can be evaluated any number of times, in any order */
+static int is_atomic(ptr i)
+{
+    return (kind(i) != T_CON || is_quote_form(i)) && !is_partial_app(i);
+}
+
+static int has_partial_app(ptr args)
+{
+    for (; kind(args) == T_CON; args = get_tail(args))
+    {
+        if (is_partial_app(get_head(args)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int contains(ptr i, ptr symbol)
+{
+    for (; kind(i) == T_CON; i = get_tail(i))
+    {
+        if (contains(get_head(i), symbol))
+        {
+            return true;
+        }
+    }
+    return i == symbol;
+}
+
+static ptr optimize_expr(ptr i, ptr bound, int depth);
+
+static ptr optimize_args(ptr args, ptr bound, int depth)
+{
+    if (kind(args) != T_CON)
+    {
+        return args;
+    }
+    i64 scope = scope_begin();
+    root(&args);
+    root(&bound);
+    ptr head = optimize_expr(get_head(args), bound, depth);
+    root(&head);
+    ptr tail = optimize_args(get_tail(args), bound, depth);
+    if (head != get_head(args) || tail != get_tail(args))
+    {
+        args = new_cons(head, tail);
+    }
+    scope_end(scope);
+    return args;
+}
+
+/* values of arguments that are constants */
+static ptr constant_values(ptr args, ptr bound)
+{
+    if (kind(args) != T_CON)
+    {
+        return new_nil();
+    }
+    i64 scope = scope_begin();
+    root(&args);
+    root(&bound);
+    ptr rest = constant_values(get_tail(args), bound);
+    root(&rest);
+    ptr value = new_nil();
+    constant_value(get_head(args), bound, &value);
+    ptr values = new_cons(value, rest);
+    scope_end(scope);
+    return values;
+}
+
+/* replaces a call of a pure builtin by its result, if its arguments are constants */
+static ptr fold(ptr call, pure_t *p, ptr bound)
+{
+    i64 len = list_len(get_tail(call));
+    if (len < p->min_len || (p->max_len >= 0 && len > p->max_len))
+    {
+        return call;
+    }
+    for (ptr args = get_tail(call); kind(args) == T_CON; args = get_tail(args))
+    {
+        ptr value;
+        if (!constant_value(get_head(args), bound, &value))
+        {
+            return call;
+        }
+        i64 k = kind(value);
+        if ((p->args == ARGS_INT && k != T_INT && k != T_BIG) ||
+            (p->args == ARGS_LIST && k != T_CON))
+        {
+            return call;
+        }
+    }
+    i64 scope = scope_begin();
+    ptr values = constant_values(get_tail(call), bound);
+    root(&values);
+    ptr result = quoted(get_fn_ptr(p->fun)(values));
+    scope_end(scope);
+    return result;
+}
+
+/*
+optimizes the clauses of a `cond`, dropping the ones whose condition is constantly nil,
+and the ones after a clause whose condition is constantly true
+*/
+static ptr optimize_clauses(ptr clauses, ptr bound, int depth)
+{
+    if (kind(clauses) != T_CON)
+    {
+        return clauses;
+    }
+    i64 scope = scope_begin();
+    ptr clause = get_head(clauses);
+    ptr test = new_nil();
+    ptr code = new_nil();
+    ptr rest = new_nil();
+    root(&clauses);
+    root(&bound);
+    root(&clause);
+    root(&test);
+    root(&code);
+    root(&rest);
+
+    test = optimize_expr(elem(0, clause), bound, depth);
+    code = optimize_expr(elem(1, clause), bound, depth);
+    ptr value;
+    int constant = constant_value(test, bound, &value);
+    if (constant && kind(value) == T_NIL)
+    {
+        clauses = optimize_clauses(get_tail(clauses), bound, depth);
+    }
+    else
+    {
+        if (!constant)
+        {
+            rest = optimize_clauses(get_tail(clauses), bound, depth);
+        }
+        if (test != elem(0, clause) || code != elem(1, clause))
+        {
+            clause = new_cons(test, new_cons(code, get_tail(get_tail(clause))));
+        }
+        if (clause != get_head(clauses) || rest != get_tail(clauses))
+        {
+            clauses = new_cons(clause, rest);
+        }
+    }
+    scope_end(scope);
+    return clauses;
+}
+
+static ptr optimize_cond(ptr i, ptr bound, int depth)
+{
+    for (ptr c = get_tail(i); kind(c) == T_CON; c = get_tail(c))
+    {
+        if (list_len(get_head(c)) < 2)
+        {
+            return i;
+        }
+    }
+    i64 scope = scope_begin();
+    root(&i);
+    ptr clauses = optimize_clauses(get_tail(i), bound, depth);
+    root(&clauses);
+    ptr value;
+    if (kind(clauses) == T_NIL)
+    {
+        // no clause can hold
+        i = clauses;
+    }
+    else if (constant_value(elem(0, get_head(clauses)), bound, &value))
+    {
+        // the first clause always holds
+        i = elem(1, get_head(clauses));
+    }
+    else if (clauses != get_tail(i))
+    {
+        i = new_cons(get_head(i), clauses);
+    }
+    scope_end(scope);
+    return i;
+}
+
+/* size of an expression in atoms */
+static i64 size(ptr i)
+{
+    if (kind(i) != T_CON || is_quote_form(i))
+    {
+        return 1;
+    }
+    i64 n = 0;
+    for (; kind(i) == T_CON; i = get_tail(i))
+    {
+        n += size(get_head(i));
+    }
+    return n;
+}
+
+/*
+whether the body of `fun` can be inlined: it only calls builtins
+and lambdas other than `fun`, which are all bound globally
+*/
+static int is_simple(ptr i, ptr fun, ptr formals)
+{
+    if (kind(i) != T_CON || is_quote_form(i))
+    {
+        return true;
+    }
+    ptr head = get_head(i);
+    if (kind(head) != T_SYM || is_member(head, formals))
+    {
+        return false;
+    }
+    ptr callee = get_symbol_binding(get_symbol(head));
+    if (!is_function(callee) || callee == fun)
+    {
+        return false;
+    }
+    for (ptr args = get_tail(i); kind(args) == T_CON; args = get_tail(args))
+    {
+        if (!is_simple(get_head(args), fun, formals))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* whether a global the body refers to is bound locally where it is inlined */
+static int captures(ptr i, ptr formals, ptr bound)
+{
+    if (kind(i) == T_SYM)
+    {
+        return !is_member(i, formals) && is_local(i, bound);
+    }
+    if (kind(i) != T_CON || is_quote_form(i))
+    {
+        return false;
+    }
+    for (; kind(i) == T_CON; i = get_tail(i))
+    {
+        if (captures(get_head(i), formals, bound))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static i64 occurrences(ptr i, ptr symbol)
+{
+    if (kind(i) != T_CON || is_quote_form(i))
+    {
+        return i == symbol;
+    }
+    i64 n = 0;
+    for (; kind(i) == T_CON; i = get_tail(i))
+    {
+        n += occurrences(get_head(i), symbol);
+    }
+    return n;
+}
+
+/* whether `symbol` is evaluated before any call in the body returns */
+static int reached_first(ptr i, ptr symbol)
+{
+    if (i == symbol)
+    {
+        return true;
+    }
+    if (kind(i) != T_CON || is_quote_form(i))
+    {
+        return false;
+    }
+    for (ptr args = get_tail(i); kind(args) == T_CON; args = get_tail(args))
+    {
+        ptr arg = get_head(args);
+        if (occurrences(arg, symbol))
+        {
+            return reached_first(arg, symbol);
+        }
+        if (!is_atomic(arg))
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+static ptr substitute(ptr i, ptr formals, ptr args);
+
+static ptr substitute_list(ptr list, ptr formals, ptr args)
+{
+    if (kind(list) != T_CON)
+    {
+        return list;
+    }
+    i64 scope = scope_begin();
+    root(&list);
+    root(&formals);
+    root(&args);
+    ptr head = substitute(get_head(list), formals, args);
+    root(&head);
+    ptr tail = substitute_list(get_tail(list), formals, args);
+    if (head != get_head(list) || tail != get_tail(list))
+    {
+        list = new_cons(head, tail);
+    }
+    scope_end(scope);
+    return list;
+}
+
+/* replaces the formal arguments in the body of a function by the passed arguments */
+static ptr substitute(ptr i, ptr formals, ptr args)
+{
+    if (kind(i) == T_SYM)
+    {
+        for (; kind(formals) == T_CON; formals = get_tail(formals), args = get_tail(args))
+        {
+            if (get_head(formals) == i)
+            {
+                return get_head(args);
+            }
+        }
+        return i;
+    }
+    if (kind(i) != T_CON || is_quote_form(i))
+    {
+        return i;
+    }
+    return substitute_list(i, formals, args);
+}
+
+/*
+replaces a call of a small global function by its body.
+the arguments are evaluated as often and in the same order as before:
+all of them are atoms, or one is not and its formal argument
+is used once, before anything else happens in the body.
+*/
+static ptr inline_call(ptr call, ptr fun, ptr bound, int depth)
+{
+    ptr formals = elem(1, fun);
+    ptr body = elem(2, fun);
+    ptr args = get_tail(call);
+    if (list_len(formals) != list_len(args) || size(body) > INLINE_MAX_SIZE ||
+        !is_simple(body, fun, formals) || captures(body, formals, bound))
+    {
+        return call;
+    }
+    int has_call = false;
+    for (ptr f = formals, a = args; kind(f) == T_CON; f = get_tail(f), a = get_tail(a))
+    {
+        if (is_atomic(get_head(a)))
+        {
+            continue;
+        }
+        if (has_call || occurrences(body, get_head(f)) != 1 || !reached_first(body, get_head(f)))
+        {
+            return call;
+        }
+        has_call = true;
+    }
+    i64 scope = scope_begin();
+    root(&bound);
+    ptr inlined = substitute(body, formals, args);
+    root(&inlined);
+    inlined = optimize_expr(inlined, bound, depth + 1);
+    scope_end(scope);
+    return inlined;
+}
+
+static ptr optimize_lambda(ptr i, ptr bound, int depth)
+{
+    if (!is_lambda(get_head(i)) || list_len(i) != 3)
+    {
+        return i;
+    }
+    i64 scope = scope_begin();
+    root(&i);
+    bound = new_cons(elem(1, i), bound);
+    root(&bound);
+    ptr body = optimize_expr(elem(2, i), bound, depth);
+    if (body != elem(2, i))
+    {
+        i = new_list(3, get_head(i), elem(1, i), body);
+    }
+    scope_end(scope);
+    return i;
+}
+
+static ptr optimize_expr(ptr i, ptr bound, int depth)
+{
+    if (kind(i) != T_CON)
+    {
+        return i;
+    }
+    ptr head = get_head(i);
+    if (is_functionlike(head))
+    {
+        return optimize_lambda(i, bound, depth);
+    }
+    if (kind(head) != T_SYM || is_definition(head) || is_quote(head))
+    {
+        return i;
+    }
+    if (is_quasiquote(head) && !is_local(head, bound))
+    {
+        // without unquotes, the quasiquoted form is a constant
+        if (kind(get_tail(i)) == T_CON && !contains(get_tail(i), unquote_symbol()))
+        {
+            return new_cons(quote_symbol(), get_tail(i));
+        }
+        return i;
+    }
+
+    ptr fun;
+    if (!global_binding(head, bound, &fun))
+    {
+        if (head != defining || is_local(head, bound))
+        {
+            return i;
+        }
+        fun = new_nil();
+    }
+    else if (kind(fun) == T_SPC)
+    {
+        if (head == sym_cond)
+        {
+            return optimize_cond(i, bound, depth);
+        }
+        if (head != sym_progn)
+        {
+            return i;
+        }
+    }
+    else if (!is_function(fun))
+    {
+        return i;
+    }
+
+    i64 scope = scope_begin();
+    root(&i);
+    root(&bound);
+    root(&fun);
+    ptr args = optimize_args(get_tail(i), bound, depth);
+    if (args != get_tail(i))
+    {
+        i = new_cons(head, args);
+    }
+    if (!has_partial_app(args))
+    {
+        for (i64 k = 0; k < PURE_LEN; k++)
+        {
+            if (fun == pure[k].fun)
+            {
+                i = fold(i, &pure[k], bound);
+            }
+        }
+        if (is_global_lambda(fun) && depth < INLINE_MAX_DEPTH)
+        {
+            i = inline_call(i, fun, bound, depth);
+        }
+    }
+    scope_end(scope);
+    return i;
+}
+
+ptr optimize(ptr i, ptr formals, ptr env)
+{
+    init_optimizer();
+    i64 scope = scope_begin();
+    ptr bound = new_nil();
+    root(&i);
+    root(&formals);
+    root(&env);
+    root(&bound);
+    for (ptr e = env; kind(e) == T_ENV; e = get_parent(e))
+    {
+        bound = new_cons(get_head(get_frame(e)), bound);
+    }
+    bound = new_cons(formals, bound);
+    i = optimize_expr(i, bound, 0);
+    scope_end(scope);
+    return i;
+}
+
+ptr optimize_definition(ptr name, ptr value)
+{
+    if (kind(value) != T_CON || !is_lambda(get_head(value)) || list_len(value) < 3)
+    {
+        return value;
+    }
+    i64 scope = scope_begin();
+    root(&value);
+    ptr closed_env = list_len(value) > 3 ? elem(3, value) : new_nil();
+    defining = name;
+    ptr body = optimize(elem(2, value), elem(1, value), closed_env);
+    defining = 0;
+    root(&body);
+    if (body != elem(2, value))
+    {
+        value = new_cons(get_head(value),
+                         new_cons(elem(1, value), new_cons(body, get_tail(get_tail(get_tail(value))))));
+    }
+    scope_end(scope);
+    return value;
+}
@@ -0,0 +1,196 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lisp.h"
+#include "assert.h"
+
+/*
+`pmap` and `pfilter`: the elements of a list are handed out in chunks
+to a pool of worker threads, which apply the function with the tree walker
+and store the results in a vector, while the main thread waits.
+a worker has its own rooted variables and allocation block while it runs,
+and stops at its next allocation when another thread collects garbage,
+see `thread_attach` in mem.c.
+changing vectors or hash maps that other elements use, or reading input,
+is not synchronized, the function should not do that.
+memoized functions can be called, their caches are changed under a lock.
+*/
+
+typedef struct
+{
+    ptr fun;
+    // the elements, which are kept alive by the list
+    ptr *items;
+    i64 len;
+    // vector of the results
+    ptr results;
+    // first element that is not handed out yet, and elements per chunk
+    i64 next;
+    i64 chunk;
+} job_t;
+
+static pthread_t workers[MAX_THREADS];
+static i64 workers_len = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static job_t *job = NULL;
+// counts the jobs, so a worker does not take part in a job twice
+static i64 job_id = 0;
+// workers the current job is for, the ones that joined it and the ones that are done
+static i64 job_threads = 0;
+static i64 job_joined = 0;
+static i64 job_done = 0;
+
+// set on the workers, which run a `pmap` inside of a `pmap` themselves
+static _Thread_local int is_worker = false;
+
+static ptr call(ptr fun, ptr args)
+{
+    return vm_enabled() ? vm_apply(fun, args) : apply(fun, args);
+}
+
+/* applies the function to chunks of elements until all are handed out */
+static void run_job(job_t *j)
+{
+    i64 scope = scope_begin();
+    ptr args = new_nil();
+    ptr result = new_nil();
+    root(&args);
+    root(&result);
+    while (true)
+    {
+        i64 begin = __atomic_fetch_add(&j->next, j->chunk, __ATOMIC_RELAXED);
+        if (begin >= j->len)
+        {
+            break;
+        }
+        i64 end = begin + j->chunk < j->len ? begin + j->chunk : j->len;
+        for (i64 k = begin; k < end; k++)
+        {
+            args = new_cons(j->items[k], new_nil());
+            result = call(j->fun, args);
+            set_vector_item(j->results, k, result);
+        }
+    }
+    scope_end(scope);
+}
+
+static void *worker(void *arg)
+{
+    (void)arg;
+    is_worker = true;
+    i64 seen = 0;
+    pthread_mutex_lock(&pool_lock);
+    while (true)
+    {
+        while (seen == job_id || job_joined == job_threads)
+        {
+            pthread_cond_wait(&work_cond, &pool_lock);
+        }
+        seen = job_id;
+        job_joined++;
+        job_t *j = job;
+        pthread_mutex_unlock(&pool_lock);
+
+        thread_attach();
+        run_job(j);
+        thread_detach();
+
+        pthread_mutex_lock(&pool_lock);
+        job_done++;
+        pthread_cond_signal(&done_cond);
+    }
+    return NULL;
+}
+
+/* starts workers until there are `threads` of them */
+static void grow_pool(i64 threads)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    // the tree walker recurses on nested calls
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    while (workers_len < threads)
+    {
+        int err = pthread_create(&workers[workers_len], &attr, worker, NULL);
+        assert(!err);
+        workers_len++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+ptr par_map(ptr fun, ptr list, i64 threads, int filter)
+{
+    if (threads <= 0)
+    {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    threads = threads < MAX_THREADS ? threads : MAX_THREADS;
+
+    i64 len = 0;
+    for (ptr l = list; kind(l) == T_CON; l = get_tail(l))
+    {
+        len++;
+    }
+    ptr *items = malloc((size_t)(len ? len : 1) * sizeof(ptr));
+    assert(items);
+    len = 0;
+    for (ptr l = list; kind(l) == T_CON; l = get_tail(l))
+    {
+        items[len++] = get_head(l);
+    }
+
+    i64 scope = scope_begin();
+    ptr results = new_nil();
+    ptr out = new_nil();
+    root(&fun);
+    root(&list);
+    root(&results);
+    root(&out);
+    results = new_vector(len, new_nil());
+
+    // about 8 chunks per thread, so threads that are faster take more
+    job_t j = {fun, items, len, results, 0, len / (8 * threads) + 1};
+    if (threads == 1 || len <= 1 || is_worker)
+    {
+        run_job(&j);
+    }
+    else
+    {
+        grow_pool(threads);
+        parallel_begin();
+        pthread_mutex_lock(&pool_lock);
+        job = &j;
+        job_id++;
+        job_threads = threads;
+        job_joined = 0;
+        job_done = 0;
+        pthread_cond_broadcast(&work_cond);
+        while (job_done < threads)
+        {
+            pthread_cond_wait(&done_cond, &pool_lock);
+        }
+        job = NULL;
+        pthread_mutex_unlock(&pool_lock);
+        parallel_end();
+    }
+
+    for (i64 k = len - 1; k >= 0; k--)
+    {
+        ptr result = get_vector_item(results, k);
+        if (!filter)
+        {
+            out = new_cons(result, out);
+        }
+        else if (kind(result) != T_NIL)
+        {
+            out = new_cons(items[k], out);
+        }
+    }
+    free(items);
+    scope_end(scope);
+    return out;
+}
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "lisp.h"
@@ -43,51 +44,74 @@ static ptr parse_list(char **input)
     }
     else
     {
+        i64 scope = scope_begin();
         ptr head = parse(input);
+        root(&head);
         ptr tail = parse_list(input);
-        return new_cons(head, tail);
+        ptr list = new_cons(head, tail);
+        scope_end(scope);
+        return list;
     }
 }
 
-static ptr parse_string(char **input, int escaped)
+/* parses the rest of a string literal, after the opening quote */
+static ptr parse_string(char **input)
 {
-    assert(**input && "unexpected EOF");
-    char chr = 0;
-    if (**input == '"' && !escaped)
+    char *end = *input;
+    while (*end != '"')
     {
-        ++*input;
-        return new_nil();
+        assert(*end && "unexpected EOF");
+        if (*end == '\\')
+        {
+            end++;
+            assert(*end && "unexpected EOF");
+        }
+        end++;
     }
-    else if (escaped)
+
+    if (!memchr(*input, '\\', (size_t)(end - *input)))
     {
-        switch (**input)
+        // without escape codes the string is the source itself
+        ptr str = new_string(*input, end - *input);
+        *input = end + 1;
+        return str;
+    }
+
+    // escape codes only make the string shorter
+    char *buf = malloc((size_t)(end - *input) + 1);
+    assert(buf);
+    i64 len = 0;
+    for (char *c = *input; c < end; c++)
+    {
+        if (*c != '\\')
+        {
+            buf[len++] = *c;
+            continue;
+        }
+        c++;
+        switch (*c)
         {
         case 'n':
-            chr = '\n';
+            buf[len++] = '\n';
             break;
         case 't':
-            chr = '\t';
+            buf[len++] = '\t';
             break;
         case '"':
-            chr = '"';
+            buf[len++] = '"';
+            break;
+        case '\\':
+            buf[len++] = '\\';
             break;
         default:
             assert(false && "unknown escape code");
         }
     }
-    else if (**input == '\\')
-    {
-        ++*input;
-        return parse_string(input, 1);
-    }
-    else
-    {
-        chr = **input;
-    }
-    ++*input;
-    ptr val = new_int(chr);
-    ptr rest = parse_string(input, 0);
-    return new_cons(val, rest);
+    *input = end + 1;
+
+    ptr str = new_string(buf, len);
+    free(buf);
+    return str;
 }
 
 ptr parse(char **input)
@@ -96,14 +120,16 @@ ptr parse(char **input)
     strip(input);
     if (is_numeric(**input))
     {
+        char *begin = *input;
         i64 num = 0;
+        int overflow = false;
         while (is_numeric(**input))
         {
-            num *= 10;
-            num += (**input) - '0';
+            overflow |= __builtin_mul_overflow(num, 10, &num);
+            overflow |= __builtin_add_overflow(num, (**input) - '0', &num);
             ++*input;
         }
-        return new_int(num);
+        return overflow ? big_parse(begin, *input - begin) : new_int(num);
     }
     else if (**input == ')')
     {
@@ -117,29 +143,29 @@ ptr parse(char **input)
     }
     else if (is_quoting(**input))
     {
-        char *sym = 0;
+        ptr symbol = 0;
         switch (**input)
         {
         case '\'':
-            sym = "quote";
+            symbol = quote_symbol();
             break;
         case '`':
-            sym = "quasiquote";
+            symbol = quasiquote_symbol();
             break;
         case '#':
-            sym = "unquote";
+            symbol = unquote_symbol();
             break;
         default:
             failwith("unknown quote");
         }
         ++*input;
-        ptr symbol = new_symbol(sym);
+        // interned symbols are not collected, so `symbol` stays valid while parsing
         return new_list(2, symbol, parse(input));
     }
     else if (**input == '"')
     {
         ++*input;
-        return new_list(2, new_symbol("quote"), parse_string(input, 0));
+        return parse_string(input);
     }
     else if (**input == ';')
     {
@@ -158,9 +184,9 @@ ptr parse(char **input)
         {
             ++*input;
         }
-        char buf[16] = {0};
-        assert(*input - begin < 16);
+        char buf[*input - begin + 1];
         memcpy(buf, begin, (size_t)(*input - begin));
+        buf[*input - begin] = 0;
         ptr sym = new_symbol(buf);
         return sym;
     }
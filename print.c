@@ -4,23 +4,50 @@
 #include "lisp.h"
 #include "assert.h"
 
-int is_string(ptr node);
-int is_string(ptr node)
+/* whether a list consists of printable characters only */
+static int is_string(ptr node)
 {
     if (kind(node) != T_CON)
         return 0;
-    ptr head = get_head(node);
-    ptr tail = get_tail(node);
-    if (kind(head) != T_INT)
-        return 0;
-    int i = get_int(head);
-    if (i >= 32 && i < 128)
+    for (; kind(node) == T_CON; node = get_tail(node))
     {
-        if (kind(tail) == T_NIL)
-            return 1;
-        return is_string(tail);
+        ptr head = get_head(node);
+        if (kind(head) != T_INT)
+            return 0;
+        i64 i = get_int(head);
+        if (i < 32 || i >= 128)
+            return 0;
     }
-    return 0;
+    return kind(node) == T_NIL;
+}
+
+/* prints a string the way it is written in the source */
+static void print_string(ptr i)
+{
+    char *bytes = get_string(i);
+    i64 len = get_string_len(i);
+    putchar('"');
+    for (i64 k = 0; k < len; k++)
+    {
+        switch (bytes[k])
+        {
+        case '\n':
+            printf("\\n");
+            break;
+        case '\t':
+            printf("\\t");
+            break;
+        case '"':
+            printf("\\\"");
+            break;
+        case '\\':
+            printf("\\\\");
+            break;
+        default:
+            putchar(bytes[k]);
+        }
+    }
+    putchar('"');
 }
 
 void print(ptr i)
@@ -33,15 +60,59 @@ void print(ptr i)
     case T_MAC:
         printf("<builtin macro>");
         return;
+    case T_SPC:
+        printf("<builtin special form>");
+        return;
     case T_INT:
         printf("%ld", get_int(i));
         return;
+    case T_BIG:
+        big_print(i);
+        return;
     case T_NIL:
         printf("nil");
         return;
     case T_SYM:
         printf("%s", get_symbol_str(get_symbol(i)));
         return;
+    case T_ENV:
+        printf("<env>");
+        return;
+    case T_STR:
+        print_string(i);
+        return;
+    case T_VEC:
+        printf("#(");
+        for (i64 k = 0; k < get_vector_len(i); k++)
+        {
+            if (k)
+            {
+                printf(" ");
+            }
+            print(get_vector_item(i, k));
+        }
+        printf(")");
+        return;
+    case T_MAP:
+    {
+        ptr key = new_nil();
+        ptr value = new_nil();
+        printf("#hash(");
+        for (i64 pos = map_next(i, 0, &key, &value); pos != -1; pos = map_next(i, pos, &key, &value))
+        {
+            printf("(");
+            print(key);
+            printf(" ");
+            print(value);
+            printf(")");
+            if (map_next(i, pos, &key, &value) != -1)
+            {
+                printf(" ");
+            }
+        }
+        printf(")");
+        return;
+    }
     case T_EMT:
         printf("<empty>");
         failwith("somehow managed to print non existent thing");
@@ -98,20 +169,21 @@ void println(ptr i)
 void dump(void)
 {
     printf("-===- DUMP BEGIN -===-\n");
-    for (ptr i = 0; i < MEM_LEN; i++)
+    for (i64 k = 0; k < heap_size(); k++)
     {
+        ptr i = node_ref(k);
         if (kind(i) == T_POO || kind(i) == T_EMT)
         {
             continue;
         }
-        printf("%04ld: `", i);
+        printf("%04ld: `", k);
         print(i);
         printf("`\n");
     }
     printf("\n");
-    for (ptr s = 0; s < SYM_LEN; s++)
+    for (ptr s = 0; s < symbol_count(); s++)
     {
-        if (strlen(get_symbol_str(s)))
+        if (get_symbol_str(s))
         {
             printf(".%03ld: (%03ld) `%s`\n", s, get_symbol_binding(s), get_symbol_str(s));
         }
@@ -0,0 +1,314 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lisp.h"
+#include "assert.h"
+
+/*
+profiler of the calls of lambdas by the tree walker, enabled by `--profile`.
+a lambda is named after the global symbol it was bound to by `new_binding`,
+the others are `lambda`. a call is counted with its time and the nodes allocated
+while it runs, in total and by itself (without the calls it makes).
+the calls also form a tree of the stacks they were made from, which is written
+as folded stacks, one line of the names on the stack and the microseconds spent
+in the last of them, which flame graph tools read.
+a tail call replaces its caller on the stack, like it does in the tree walker.
+every thread has its own stack, the tables are shared.
+*/
+
+typedef struct
+{
+    ptr fun;
+    char *name;
+    i64 calls;
+    // frames of the function on the stacks, only the outermost counts the totals
+    i64 active;
+    i64 total_us;
+    i64 self_us;
+    i64 total_nodes;
+    i64 self_nodes;
+} function_t;
+
+// node of the call tree, its children are a linked list
+typedef struct
+{
+    i64 function;
+    i64 first_child;
+    i64 next_sibling;
+    i64 self_us;
+} call_t;
+
+typedef struct
+{
+    i64 function;
+    i64 call;
+    i64 begin_us;
+    i64 begin_nodes;
+} frame_t;
+
+static int enabled = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// function 0 stands for the anonymous lambdas
+static function_t *functions = NULL;
+static i64 functions_len = 0;
+static i64 functions_cap = 0;
+
+// functions by the address of their lambda, open addressing, 0 marks empty slots
+static i64 *by_fun = NULL;
+static i64 by_fun_cap = 0;
+
+// call 0 is the root, the code that is not in a function
+static call_t *calls = NULL;
+static i64 calls_len = 0;
+static i64 calls_cap = 0;
+
+static _Thread_local frame_t *stack = NULL;
+static _Thread_local i64 stack_len = 0;
+static _Thread_local i64 stack_cap = 0;
+// time and allocated nodes of the thread when the last call began or ended
+static _Thread_local i64 last_us = 0;
+static _Thread_local i64 last_nodes = 0;
+// the time of the main thread outside of functions counts, the workers are idle then
+static _Thread_local int is_main = false;
+
+static i64 now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (i64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *grow_array(void *array, i64 len, i64 *cap, size_t size)
+{
+    if (len < *cap)
+    {
+        return array;
+    }
+    *cap = *cap ? 2 * *cap : 64;
+    array = realloc(array, (size_t)*cap * size);
+    assert(array);
+    return array;
+}
+
+static i64 index_slot(i64 *table, i64 cap, ptr fun)
+{
+    i64 mask = cap - 1;
+    i64 slot = (i64)(((uint64_t)fun * 0x9e3779b97f4a7c15u) >> 32) & mask;
+    while (table[slot] && functions[table[slot]].fun != fun)
+    {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static i64 add_function(ptr fun, char *name)
+{
+    functions = grow_array(functions, functions_len, &functions_cap, sizeof(function_t));
+    functions[functions_len] = (function_t){fun, name, 0, 0, 0, 0, 0, 0};
+    return functions_len++;
+}
+
+static i64 add_call(i64 function)
+{
+    calls = grow_array(calls, calls_len, &calls_cap, sizeof(call_t));
+    calls[calls_len] = (call_t){function, 0, 0, 0};
+    return calls_len++;
+}
+
+void profile_enable(void)
+{
+    enabled = true;
+    add_function(new_nil(), "lambda");
+    add_call(0);
+    last_us = now_us();
+    is_main = true;
+}
+
+int profile_enabled(void)
+{
+    return enabled;
+}
+
+void profile_name(ptr symbol, ptr value)
+{
+    if (!enabled || kind(value) != T_CON || !is_lambda(get_head(value)))
+    {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (2 * functions_len > by_fun_cap)
+    {
+        // the index is rebuilt from the functions, as they are never removed
+        i64 cap = by_fun_cap ? 2 * by_fun_cap : 1024;
+        free(by_fun);
+        by_fun = calloc((size_t)cap, sizeof(i64));
+        assert(by_fun);
+        by_fun_cap = cap;
+        for (i64 f = 1; f < functions_len; f++)
+        {
+            by_fun[index_slot(by_fun, by_fun_cap, functions[f].fun)] = f;
+        }
+    }
+    // definitions are not shadowed, so the lambda stays alive with its name
+    i64 slot = index_slot(by_fun, by_fun_cap, value);
+    if (!by_fun[slot])
+    {
+        by_fun[slot] = add_function(value, get_symbol_str(get_symbol(symbol)));
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* charges the time and the nodes since the last call began or ended to the one running */
+static void charge(i64 now, i64 nodes)
+{
+    if (stack_len)
+    {
+        frame_t *top = &stack[stack_len - 1];
+        functions[top->function].self_us += now - last_us;
+        functions[top->function].self_nodes += nodes - last_nodes;
+        calls[top->call].self_us += now - last_us;
+    }
+    else if (is_main)
+    {
+        calls[0].self_us += now - last_us;
+    }
+    last_us = now;
+    last_nodes = nodes;
+}
+
+void profile_call(ptr fun)
+{
+    i64 now = now_us();
+    i64 nodes = thread_allocated();
+    pthread_mutex_lock(&lock);
+    charge(now, nodes);
+
+    i64 function = 0;
+    if (by_fun_cap)
+    {
+        function = by_fun[index_slot(by_fun, by_fun_cap, fun)];
+    }
+    functions[function].calls++;
+    functions[function].active++;
+
+    i64 parent = stack_len ? stack[stack_len - 1].call : 0;
+    i64 call = calls[parent].first_child;
+    while (call && calls[call].function != function)
+    {
+        call = calls[call].next_sibling;
+    }
+    if (!call)
+    {
+        call = add_call(function);
+        calls[call].next_sibling = calls[parent].first_child;
+        calls[parent].first_child = call;
+    }
+    pthread_mutex_unlock(&lock);
+
+    stack = grow_array(stack, stack_len, &stack_cap, sizeof(frame_t));
+    stack[stack_len++] = (frame_t){function, call, now, nodes};
+}
+
+void profile_return(void)
+{
+    i64 now = now_us();
+    i64 nodes = thread_allocated();
+    pthread_mutex_lock(&lock);
+    charge(now, nodes);
+    frame_t *frame = &stack[--stack_len];
+    function_t *f = &functions[frame->function];
+    if (--f->active == 0)
+    {
+        f->total_us += now - frame->begin_us;
+        f->total_nodes += nodes - frame->begin_nodes;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static int compare_self_us(const void *a, const void *b)
+{
+    i64 x = functions[*(const i64 *)a].self_us;
+    i64 y = functions[*(const i64 *)b].self_us;
+    return (x < y) - (x > y);
+}
+
+/* writes the stacks that spent time, in a depth first walk of the call tree */
+static void write_folded(FILE *out)
+{
+    i64 *path = malloc((size_t)calls_len * sizeof(i64));
+    assert(path);
+    i64 path_len = 0;
+    i64 call = 0;
+    while (true)
+    {
+        path[path_len++] = call;
+        if (calls[call].self_us)
+        {
+            fprintf(out, "toplevel");
+            for (i64 k = 1; k < path_len; k++)
+            {
+                fprintf(out, ";%s", functions[calls[path[k]].function].name);
+            }
+            fprintf(out, " %ld\n", calls[call].self_us);
+        }
+        if (calls[call].first_child)
+        {
+            call = calls[call].first_child;
+            continue;
+        }
+        // back up to the first call on the path that has a next sibling
+        while (path_len > 1 && !calls[path[path_len - 1]].next_sibling)
+        {
+            path_len--;
+        }
+        if (path_len == 1)
+        {
+            break;
+        }
+        call = calls[path[--path_len]].next_sibling;
+    }
+    free(path);
+}
+
+void profile_report(void)
+{
+    pthread_mutex_lock(&lock);
+    charge(now_us(), thread_allocated());
+
+    i64 *order = malloc((size_t)functions_len * sizeof(i64));
+    assert(order);
+    for (i64 f = 0; f < functions_len; f++)
+    {
+        order[f] = f;
+    }
+    qsort(order, (size_t)functions_len, sizeof(i64), compare_self_us);
+    fprintf(stderr, "%12s %12s %12s %14s %14s  %s\n",
+            "calls", "total ms", "self ms", "total nodes", "self nodes", "function");
+    for (i64 k = 0; k < functions_len; k++)
+    {
+        function_t *f = &functions[order[k]];
+        if (f->calls)
+        {
+            fprintf(stderr, "%12ld %12.1f %12.1f %14ld %14ld  %s\n",
+                    f->calls, f->total_us / 1000.0, f->self_us / 1000.0,
+                    f->total_nodes, f->self_nodes, f->name);
+        }
+    }
+    free(order);
+
+    FILE *out = fopen(PROFILE_PATH, "w");
+    if (out)
+    {
+        write_folded(out);
+        fclose(out);
+        fprintf(stderr, "The stacks were written to %s\n", PROFILE_PATH);
+    }
+    else
+    {
+        fprintf(stderr, "Could not write %s\n", PROFILE_PATH);
+    }
+    pthread_mutex_unlock(&lock);
+}
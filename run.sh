@@ -2,9 +2,9 @@
 
 rm lisp.bin
 
-gcc -g -Oz *.c *.s \
+gcc -g -Oz *.c \
     -o lisp.bin \
-    -std=c17 -pedantic -Wall -Wshadow -Wpointer-arith -Wcast-qual \
+    -std=c17 -pedantic -Wall -Wshadow -Wpointer-arith -Wcast-qual -pthread \
         -Wstrict-prototypes
 
 ./lisp.bin
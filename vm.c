@@ -0,0 +1,918 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lisp.h"
+#include "assert.h"
+
+/*
+bytecode compiler and virtual machine, used instead of the tree walker
+in `eval.c` if the interpreter is started with `--vm`.
+
+the body of a function is compiled the first time the function is called.
+its arguments live in slots on the value stack instead of in environment
+frames, `cond` and `progn` are compiled to jumps and calls in tail position
+reuse the frame of the caller.
+calls of macros that are bound when the body is compiled are expanded
+and compiled the first time they are run.
+forms the compiler does not know are evaluated by the tree walker.
+*/
+
+#define OP_CONST 0     // k: pushes constant k
+#define OP_LOCAL 1     // n: pushes the argument in slot n
+#define OP_GLOBAL 2    // k: pushes the global binding of symbol k
+#define OP_LOOKUP 3    // k: pushes the binding of symbol k in the closure environment
+#define OP_CLOSURE 4   // k: pushes lambda or macro expression k closed over the frame
+#define OP_POP 5       // drops the top of the stack
+#define OP_JUMP 6      // t: continues at t
+#define OP_JUMP_NIL 7  // t: pops a value, continues at t if it is nil
+#define OP_DEF 8       // k: binds symbol k to the top of the stack, replaces it by nil
+#define OP_CHECK 9     // k t: if the top of the stack is not a function, it is applied
+                       //      to the unevaluated arguments k by the tree walker
+                       //      and execution continues at t
+#define OP_CALL 10     // n: calls the function below the n arguments on top of the stack
+#define OP_TAILCALL 11 // n: same, but replaces the current frame
+#define OP_RET 12      // returns the top of the stack
+#define OP_FALLBACK 13 // k: evaluates expression k with the tree walker
+#define OP_EXPAND 14   // x: runs the compiled expansion of macro call x
+#define OP_TAILEXPAND 15
+
+typedef struct code code_t;
+
+/* macro call, expanded and compiled the first time it is run */
+typedef struct
+{
+    ptr form;
+    ptr expansion;
+    code_t *code;
+} expansion_t;
+
+struct code
+{
+    int32_t *ops;
+    i64 ops_len;
+    i64 ops_cap;
+
+    ptr *consts;
+    i64 consts_len;
+    i64 consts_cap;
+
+    expansion_t *expansions;
+    i64 expansions_len;
+    i64 expansions_cap;
+
+    // formal arguments, their values are in the slots 0 to n_params - 1
+    ptr formals;
+    i64 n_params;
+    // the body the code was compiled from
+    ptr body;
+    // the function closes over the global environment only,
+    // so free symbols are looked up in the symbol table directly
+    int global;
+    // top level expression, it has no slots and is run in the environment
+    // it is evaluated in instead of a frame of its own
+    int top;
+
+    // next code in the same bucket of the cache
+    code_t *next;
+};
+
+/*
+a function call in progress.
+the function is at `base` on the value stack, followed by the slots of the
+arguments, the environment of the closure and the environment of the frame,
+which is only created when a closure or the tree walker needs it.
+*/
+typedef struct
+{
+    code_t *code;
+    i64 pc;
+    i64 base;
+} frame_t;
+
+#define CLOSURE_ENV(f) (stack[(f)->base + (f)->code->n_params + 1])
+#define FRAME_ENV(f) (stack[(f)->base + (f)->code->n_params + 2])
+
+// per thread, the workers of `pmap` use the tree walker
+static _Thread_local int enabled = false;
+
+static ptr *stack = NULL;
+static i64 sp = 0;
+static i64 stack_cap = 0;
+
+static frame_t *frames = NULL;
+static i64 frames_len = 0;
+static i64 frames_cap = 0;
+
+/* compiled function bodies, by formal arguments and body */
+static code_t **cache = NULL;
+static i64 cache_len = 0;
+static i64 cache_count = 0;
+
+/* top level expressions that are being run */
+static code_t *top_codes = NULL;
+
+/* environment of the function that is being compiled */
+static ptr compile_env = 0;
+
+static ptr sym_cond = 0;
+static ptr sym_progn = 0;
+
+void vm_enable(void)
+{
+    enabled = true;
+    sym_cond = new_symbol("cond");
+    sym_progn = new_symbol("progn");
+}
+
+int vm_enabled(void)
+{
+    return enabled;
+}
+
+/* grows a dynamic array so that it can hold one more element */
+static void *reserve(void *array, i64 len, i64 *cap, size_t size)
+{
+    if (len < *cap)
+    {
+        return array;
+    }
+    *cap = *cap ? 2 * *cap : 1024;
+    array = realloc(array, (size_t)*cap * size);
+    assert(array);
+    return array;
+}
+
+static void push(ptr value)
+{
+    stack = reserve(stack, sp, &stack_cap, sizeof(ptr));
+    stack[sp++] = value;
+}
+
+/* number of elements of a list, -1 if it is not a proper list */
+static i64 list_len(ptr list)
+{
+    i64 len = 0;
+    while (kind(list) == T_CON)
+    {
+        len++;
+        list = get_tail(list);
+    }
+    return kind(list) == T_NIL ? len : -1;
+}
+
+static ptr closure_env(ptr fun)
+{
+    ptr rest = get_tail(get_tail(get_tail(fun)));
+    if (kind(rest) == T_CON)
+    {
+        return get_head(rest);
+    }
+    return new_nil();
+}
+
+// -- compiler -- //
+
+static code_t *new_code(ptr formals, ptr body, int global, int top)
+{
+    code_t *c = calloc(1, sizeof(code_t));
+    assert(c);
+    c->formals = formals;
+    c->n_params = list_len(formals);
+    c->body = body;
+    c->global = global;
+    c->top = top;
+    if (c->n_params < 0)
+    {
+        println(formals);
+        failwith("formal arguments have to be a list");
+    }
+    return c;
+}
+
+static void free_code(code_t *c)
+{
+    for (i64 k = 0; k < c->expansions_len; k++)
+    {
+        if (c->expansions[k].code)
+        {
+            free_code(c->expansions[k].code);
+        }
+    }
+    free(c->expansions);
+    free(c->consts);
+    free(c->ops);
+    free(c);
+}
+
+static void emit(code_t *c, i64 op)
+{
+    c->ops = reserve(c->ops, c->ops_len, &c->ops_cap, sizeof(int32_t));
+    c->ops[c->ops_len++] = (int32_t)op;
+}
+
+static i64 add_const(code_t *c, ptr value)
+{
+    c->consts = reserve(c->consts, c->consts_len, &c->consts_cap, sizeof(ptr));
+    c->consts[c->consts_len] = value;
+    return c->consts_len++;
+}
+
+static i64 slot_of(code_t *c, ptr symbol)
+{
+    i64 k = 0;
+    for (ptr f = c->formals; kind(f) == T_CON; f = get_tail(f), k++)
+    {
+        if (get_head(f) == symbol)
+        {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* whether a symbol refers to its global binding where it is compiled */
+static int is_global_symbol(code_t *c, ptr symbol)
+{
+    if (kind(symbol) != T_SYM || slot_of(c, symbol) >= 0)
+    {
+        return false;
+    }
+    for (ptr e = compile_env; kind(e) == T_ENV; e = get_parent(e))
+    {
+        for (ptr f = get_head(get_frame(e)); kind(f) == T_CON; f = get_tail(f))
+        {
+            if (get_head(f) == symbol)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void compile(code_t *c, ptr i, int tail);
+
+static void compile_symbol(code_t *c, ptr symbol)
+{
+    i64 slot = slot_of(c, symbol);
+    if (slot >= 0)
+    {
+        emit(c, OP_LOCAL);
+        emit(c, slot);
+    }
+    else
+    {
+        emit(c, c->global ? OP_GLOBAL : OP_LOOKUP);
+        emit(c, add_const(c, symbol));
+    }
+}
+
+/*
+the jumps to the end of a `cond` are chained through their targets
+until the end is known
+*/
+static void compile_cond(code_t *c, ptr clauses, int tail)
+{
+    i64 end = -1;
+    for (; kind(clauses) == T_CON; clauses = get_tail(clauses))
+    {
+        ptr clause = get_head(clauses);
+        compile(c, elem(0, clause), false);
+        emit(c, OP_JUMP_NIL);
+        i64 next = c->ops_len;
+        emit(c, 0);
+        compile(c, elem(1, clause), tail);
+        emit(c, OP_JUMP);
+        emit(c, end);
+        end = c->ops_len - 1;
+        c->ops[next] = (int32_t)c->ops_len;
+    }
+    emit(c, OP_CONST);
+    emit(c, add_const(c, new_nil()));
+    while (end >= 0)
+    {
+        i64 prev = c->ops[end];
+        c->ops[end] = (int32_t)c->ops_len;
+        end = prev;
+    }
+}
+
+static void compile_progn(code_t *c, ptr forms, int tail)
+{
+    if (kind(forms) == T_NIL)
+    {
+        emit(c, OP_CONST);
+        emit(c, add_const(c, new_nil()));
+        return;
+    }
+    for (; kind(get_tail(forms)) == T_CON; forms = get_tail(forms))
+    {
+        compile(c, get_head(forms), false);
+        emit(c, OP_POP);
+    }
+    compile(c, get_head(forms), tail);
+}
+
+static void compile_call(code_t *c, ptr i, int tail)
+{
+    compile(c, get_head(i), false);
+    emit(c, OP_CHECK);
+    emit(c, add_const(c, get_tail(i)));
+    i64 after = c->ops_len;
+    emit(c, 0);
+    i64 n = 0;
+    for (ptr args = get_tail(i); kind(args) == T_CON; args = get_tail(args), n++)
+    {
+        compile(c, get_head(args), false);
+    }
+    emit(c, tail ? OP_TAILCALL : OP_CALL);
+    emit(c, n);
+    c->ops[after] = (int32_t)c->ops_len;
+}
+
+static int is_well_formed_cond(ptr clauses)
+{
+    for (; kind(clauses) == T_CON; clauses = get_tail(clauses))
+    {
+        if (list_len(get_head(clauses)) < 2)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int has_partial_app(ptr args)
+{
+    for (; kind(args) == T_CON; args = get_tail(args))
+    {
+        if (is_partial_app(get_head(args)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void compile_fallback(code_t *c, ptr i)
+{
+    emit(c, OP_FALLBACK);
+    emit(c, add_const(c, i));
+}
+
+/* compiles code that pushes the value of an expression */
+static void compile(code_t *c, ptr i, int tail)
+{
+    switch (kind(i))
+    {
+    case T_NIL:
+    case T_INT:
+    case T_STR:
+    case T_VEC:
+    case T_MAP:
+    case T_BIG:
+    case T_FUN:
+    case T_MAC:
+    case T_SPC:
+        emit(c, OP_CONST);
+        emit(c, add_const(c, i));
+        return;
+    case T_SYM:
+        compile_symbol(c, i);
+        return;
+    case T_CON:
+        break;
+    default:
+        compile_fallback(c, i);
+        return;
+    }
+
+    ptr head = get_head(i);
+    ptr args = get_tail(i);
+    i64 n = list_len(args);
+    if (n < 0)
+    {
+        compile_fallback(c, i);
+    }
+    else if (is_functionlike(head))
+    {
+        emit(c, n >= 2 ? OP_CLOSURE : OP_FALLBACK);
+        emit(c, add_const(c, i));
+    }
+    else if (is_definition(head))
+    {
+        if (n < 2 || kind(elem(0, args)) != T_SYM)
+        {
+            compile_fallback(c, i);
+            return;
+        }
+        compile(c, elem(1, args), false);
+        emit(c, OP_DEF);
+        emit(c, add_const(c, elem(0, args)));
+    }
+    else if (is_global_symbol(c, head))
+    {
+        ptr bind = get_symbol_binding(get_symbol(head));
+        if (head == quote_symbol() && n >= 1)
+        {
+            emit(c, OP_CONST);
+            emit(c, add_const(c, elem(0, args)));
+        }
+        else if (head == sym_cond && is_well_formed_cond(args))
+        {
+            compile_cond(c, args, tail);
+        }
+        else if (head == sym_progn)
+        {
+            compile_progn(c, args, tail);
+        }
+        else if (kind(bind) == T_CON && is_macro(get_head(bind)) && !has_partial_app(args))
+        {
+            expansion_t expansion = {i, new_nil(), NULL};
+            c->expansions = reserve(c->expansions, c->expansions_len, &c->expansions_cap,
+                                    sizeof(expansion_t));
+            c->expansions[c->expansions_len] = expansion;
+            emit(c, tail ? OP_TAILEXPAND : OP_EXPAND);
+            emit(c, c->expansions_len++);
+        }
+        else if (kind(bind) == T_MAC || kind(bind) == T_SPC)
+        {
+            compile_fallback(c, i);
+        }
+        else
+        {
+            compile_call(c, i, tail);
+        }
+    }
+    else
+    {
+        compile_call(c, i, tail);
+    }
+}
+
+// -- cache of compiled functions -- //
+
+static i64 bucket(ptr formals, ptr body)
+{
+    uint64_t hash = (uint64_t)body * 0x9E3779B97F4A7C15u ^ (uint64_t)formals;
+    return (i64)((hash >> 32) & (uint64_t)(cache_len - 1));
+}
+
+static void grow_cache(void)
+{
+    i64 old_len = cache_len;
+    code_t **old = cache;
+    cache_len = cache_len ? 2 * cache_len : 256;
+    cache = calloc((size_t)cache_len, sizeof(code_t *));
+    assert(cache);
+    for (i64 b = 0; b < old_len; b++)
+    {
+        while (old[b])
+        {
+            code_t *c = old[b];
+            old[b] = c->next;
+            i64 k = bucket(c->formals, c->body);
+            c->next = cache[k];
+            cache[k] = c;
+        }
+    }
+    free(old);
+}
+
+/* compiled body of a function, it is compiled if it is called for the first time */
+static code_t *get_code(ptr fun, ptr env)
+{
+    ptr formals = elem(1, fun);
+    ptr body = elem(2, fun);
+    int global = kind(env) == T_NIL;
+
+    if (cache_count >= cache_len)
+    {
+        grow_cache();
+    }
+    i64 k = bucket(formals, body);
+    for (code_t *c = cache[k]; c; c = c->next)
+    {
+        if (c->formals == formals && c->body == body && c->global == global)
+        {
+            return c;
+        }
+    }
+
+    code_t *c = new_code(formals, body, global, false);
+    compile_env = env;
+    compile(c, body, true);
+    emit(c, OP_RET);
+    compile_env = new_nil();
+
+    c->next = cache[k];
+    cache[k] = c;
+    cache_count++;
+    return c;
+}
+
+/*
+called after the garbage collector freed nodes,
+drops the code of functions whose body is gone
+*/
+void vm_sweep(void)
+{
+    for (i64 b = 0; b < cache_len; b++)
+    {
+        code_t **link = &cache[b];
+        while (*link)
+        {
+            code_t *c = *link;
+            if (is_live(c->formals) && is_live(c->body))
+            {
+                link = &c->next;
+                continue;
+            }
+            *link = c->next;
+            free_code(c);
+            cache_count--;
+        }
+    }
+}
+
+static void mark_expansions(code_t *c, void (*mark)(ptr))
+{
+    for (i64 k = 0; k < c->expansions_len; k++)
+    {
+        mark(c->expansions[k].expansion);
+        if (c->expansions[k].code)
+        {
+            mark_expansions(c->expansions[k].code, mark);
+        }
+    }
+}
+
+/*
+the values on the stack and the macro expansions are GC roots.
+the other constants are parts of the body of a function,
+they are alive as long as it is.
+*/
+void vm_mark_roots(void (*mark)(ptr))
+{
+    for (i64 k = 0; k < sp; k++)
+    {
+        mark(stack[k]);
+    }
+    for (i64 b = 0; b < cache_len; b++)
+    {
+        for (code_t *c = cache[b]; c; c = c->next)
+        {
+            mark_expansions(c, mark);
+        }
+    }
+    for (code_t *c = top_codes; c; c = c->next)
+    {
+        mark_expansions(c, mark);
+    }
+}
+
+// -- virtual machine -- //
+
+static void push_frame(code_t *code, i64 base)
+{
+    frames = reserve(frames, frames_len, &frames_cap, sizeof(frame_t));
+    frame_t frame = {code, 0, base};
+    frames[frames_len++] = frame;
+}
+
+/* environment of a frame, for closures and the tree walker */
+static ptr frame_env(frame_t *f)
+{
+    if (f->code->top || kind(FRAME_ENV(f)) != T_NIL)
+    {
+        return FRAME_ENV(f);
+    }
+    i64 scope = scope_begin();
+    ptr values = new_nil();
+    root(&values);
+    for (i64 k = f->code->n_params - 1; k >= 0; k--)
+    {
+        values = new_cons(stack[f->base + 1 + k], values);
+    }
+    ptr env = new_env(f->code->formals, values, CLOSURE_ENV(f));
+    FRAME_ENV(f) = env;
+    scope_end(scope);
+    return env;
+}
+
+static ptr lookup(ptr env, ptr symbol)
+{
+    for (ptr e = env; kind(e) == T_ENV; e = get_parent(e))
+    {
+        ptr frame = get_frame(e);
+        ptr values = get_tail(frame);
+        for (ptr f = get_head(frame); kind(f) == T_CON; f = get_tail(f))
+        {
+            if (get_head(f) == symbol)
+            {
+                return get_head(values);
+            }
+            values = get_tail(values);
+        }
+    }
+    return get_symbol_binding(get_symbol(symbol));
+}
+
+static void check_bound(ptr value, ptr symbol)
+{
+    if (kind(value) == T_POO)
+    {
+        printf("`%s` is unbound.\n", get_symbol_str(get_symbol(symbol)));
+        assert(false);
+    }
+}
+
+/* pops the arguments and the function from the stack, leaves them in a list */
+static ptr pop_args(i64 n)
+{
+    i64 scope = scope_begin();
+    ptr args = new_nil();
+    root(&args);
+    for (i64 k = sp - 1; k > sp - 1 - n; k--)
+    {
+        args = new_cons(stack[k], args);
+    }
+    sp -= n;
+    scope_end(scope);
+    return args;
+}
+
+static void call_builtin(i64 n)
+{
+    i64 scope = scope_begin();
+    ptr args = pop_args(n);
+    root(&args);
+    ptr fun = stack[--sp];
+    ptr result = get_fn_ptr(fun)(args);
+    scope_end(scope);
+    push(result);
+}
+
+/* calls the closure below the `n` arguments on top of the stack */
+static void call_closure(i64 n, int tail)
+{
+    i64 base = sp - n - 1;
+    for (i64 k = base + 1; k < sp; k++)
+    {
+        if (is_partial_app(stack[k]))
+        {
+            // partial application returns a closure, the tree walker creates it
+            i64 scope = scope_begin();
+            ptr args = pop_args(n);
+            root(&args);
+            ptr fun = stack[--sp];
+            root(&fun);
+            push(apply(fun, args));
+            scope_end(scope);
+            return;
+        }
+    }
+
+    ptr env = closure_env(stack[base]);
+    code_t *code = get_code(stack[base], env);
+    if (n < code->n_params)
+    {
+        println(stack[base]);
+        failwith("too few arguments");
+    }
+    // extra arguments are ignored
+    sp = base + 1 + code->n_params;
+
+    if (tail)
+    {
+        frame_t *f = &frames[--frames_len];
+        memmove(&stack[f->base], &stack[base], (size_t)(sp - base) * sizeof(ptr));
+        sp = f->base + (sp - base);
+        base = f->base;
+    }
+    push(env);
+    push(new_nil());
+    push_frame(code, base);
+}
+
+/* runs the expansion of a macro call, copying the slots of the frame */
+static void run_expansion(i64 idx, int tail)
+{
+    frame_t *f = &frames[frames_len - 1];
+    code_t *c = f->code;
+    if (!c->expansions[idx].code)
+    {
+        ptr form = c->expansions[idx].form;
+        ptr macro = get_symbol_binding(get_symbol(get_head(form)));
+        ptr expansion = expand_macro(macro, get_tail(form));
+        // the VM might have been reentered
+        f = &frames[frames_len - 1];
+
+        i64 scope = scope_begin();
+        root(&expansion);
+        expansion = optimize(expansion, c->formals, CLOSURE_ENV(f));
+        code_t *sub = new_code(c->formals, c->body, c->global, c->top);
+        compile_env = CLOSURE_ENV(f);
+        compile(sub, expansion, true);
+        emit(sub, OP_RET);
+        compile_env = new_nil();
+        scope_end(scope);
+
+        if (c->expansions[idx].code)
+        {
+            // the macro was expanded while it was being expanded
+            free_code(sub);
+        }
+        else
+        {
+            c->expansions[idx].expansion = expansion;
+            c->expansions[idx].code = sub;
+        }
+    }
+    code_t *sub = c->expansions[idx].code;
+
+    if (tail)
+    {
+        // the slots stay the same, only the code changes
+        f->code = sub;
+        f->pc = 0;
+        sp = f->base + sub->n_params + 3;
+        return;
+    }
+    i64 base = sp;
+    for (i64 k = f->base; k < f->base + c->n_params + 3; k++)
+    {
+        push(stack[k]);
+    }
+    push_frame(sub, base);
+}
+
+/* runs until the frame at depth `entry` returns */
+static ptr run(i64 entry)
+{
+    while (true)
+    {
+        frame_t *f = &frames[frames_len - 1];
+        code_t *c = f->code;
+        int32_t op = c->ops[f->pc++];
+        switch (op)
+        {
+        case OP_CONST:
+            push(c->consts[c->ops[f->pc++]]);
+            break;
+        case OP_LOCAL:
+            push(stack[f->base + 1 + c->ops[f->pc++]]);
+            break;
+        case OP_GLOBAL:
+        {
+            ptr symbol = c->consts[c->ops[f->pc++]];
+            ptr value = get_symbol_binding(get_symbol(symbol));
+            check_bound(value, symbol);
+            push(value);
+            break;
+        }
+        case OP_LOOKUP:
+        {
+            ptr symbol = c->consts[c->ops[f->pc++]];
+            ptr value = lookup(CLOSURE_ENV(f), symbol);
+            check_bound(value, symbol);
+            push(value);
+            break;
+        }
+        case OP_CLOSURE:
+        {
+            ptr fun = c->consts[c->ops[f->pc++]];
+            ptr env = frame_env(f);
+            if (kind(env) != T_NIL)
+            {
+                fun = new_list(4, elem(0, fun), elem(1, fun), elem(2, fun), env);
+            }
+            push(fun);
+            break;
+        }
+        case OP_POP:
+            sp--;
+            break;
+        case OP_JUMP:
+            f->pc = c->ops[f->pc];
+            break;
+        case OP_JUMP_NIL:
+            if (kind(stack[--sp]) == T_NIL)
+            {
+                f->pc = c->ops[f->pc];
+            }
+            else
+            {
+                f->pc++;
+            }
+            break;
+        case OP_DEF:
+        {
+            ptr name = c->consts[c->ops[f->pc++]];
+            stack[sp - 1] = optimize_definition(name, stack[sp - 1]);
+            new_binding(name, stack[sp - 1]);
+            stack[sp - 1] = new_nil();
+            break;
+        }
+        case OP_CHECK:
+        {
+            ptr fun = stack[sp - 1];
+            if (kind(fun) == T_FUN || (kind(fun) == T_CON && is_lambda(get_head(fun))))
+            {
+                f->pc += 2;
+                break;
+            }
+            // macros, special forms and errors are left to the tree walker
+            ptr args = c->consts[c->ops[f->pc]];
+            f->pc = c->ops[f->pc + 1];
+            ptr env = frame_env(f);
+            ptr form = new_cons(quoted(stack[sp - 1]), args);
+            ptr result = eval_in(form, env);
+            stack[sp - 1] = result;
+            break;
+        }
+        case OP_CALL:
+        case OP_TAILCALL:
+        {
+            i64 n = c->ops[f->pc++];
+            if (kind(stack[sp - n - 1]) == T_FUN)
+            {
+                call_builtin(n);
+            }
+            else
+            {
+                call_closure(n, op == OP_TAILCALL);
+            }
+            break;
+        }
+        case OP_RET:
+        {
+            ptr result = stack[sp - 1];
+            sp = f->base;
+            frames_len--;
+            if (frames_len == entry)
+            {
+                return result;
+            }
+            push(result);
+            break;
+        }
+        case OP_FALLBACK:
+        {
+            ptr i = c->consts[c->ops[f->pc++]];
+            push(eval_in(i, frame_env(f)));
+            break;
+        }
+        case OP_EXPAND:
+        case OP_TAILEXPAND:
+            run_expansion(c->ops[f->pc++], op == OP_TAILEXPAND);
+            break;
+        default:
+            failwith("unknown opcode");
+        }
+    }
+}
+
+/* evaluates an expression in the current environment */
+ptr vm_eval(ptr i)
+{
+    i64 entry = frames_len;
+    i64 base = sp;
+    ptr env = get_env();
+    push(i);
+    push(env);
+    push(env);
+
+    code_t *code = new_code(new_nil(), i, kind(env) == T_NIL, true);
+    compile_env = env;
+    compile(code, i, true);
+    emit(code, OP_RET);
+    compile_env = new_nil();
+
+    code->next = top_codes;
+    top_codes = code;
+    push_frame(code, base);
+    ptr result = run(entry);
+    top_codes = code->next;
+    free_code(code);
+    return result;
+}
+
+/* applies a closure to evaluated arguments */
+ptr vm_apply(ptr fun, ptr args)
+{
+    i64 entry = frames_len;
+    push(fun);
+    i64 n = 0;
+    for (; kind(args) == T_CON; args = get_tail(args), n++)
+    {
+        push(get_head(args));
+    }
+    call_closure(n, false);
+    if (frames_len == entry)
+    {
+        // partial application, the closure is on the stack
+        return stack[--sp];
+    }
+    return run(entry);
+}